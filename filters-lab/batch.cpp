@@ -0,0 +1,182 @@
+#include "batch.h"
+#include "boundedqueue.h"
+#include <exception>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	struct Decoded
+	{
+		std::size_t index;
+		QImage image;
+	};
+
+	struct Encoded
+	{
+		fs::path path;
+		QImage image;
+	};
+
+	bool isImage(const fs::path& path)
+	{
+		std::string ext = path.extension().string();
+		std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return char(std::tolower(uchar(c))); });
+		return ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".bmp" || ext == ".ppm" || ext == ".pgm" || ext == ".tif" || ext == ".tiff";
+	}
+
+	fs::path outputDir(const BatchOptions& options, const fs::path& input)
+	{
+		if (options.inputRoot.empty())
+			return options.outputRoot;
+		fs::path relative = input.lexically_relative(options.inputRoot);
+		if (relative.empty() || *relative.begin() == "..")
+			relative = input.filename();
+		return options.outputRoot / relative.parent_path() / relative.stem();
+	}
+
+	QString toQString(const fs::path& path)
+	{
+		return QString(path.u8string().c_str());
+	}
+
+	template <class Body>
+	void runThreads(int count, Body body)
+	{
+		std::vector<std::thread> threads;
+		for (int i = 0; i < count; i++)
+			threads.emplace_back(body);
+		for (std::thread& thread : threads)
+			thread.join();
+	}
+}
+
+std::vector<fs::path> scanDirectory(const fs::path& dir)
+{
+	std::vector<fs::path> files;
+	for (const fs::directory_entry& entry : fs::recursive_directory_iterator(dir))
+		if (entry.is_regular_file() && isImage(entry.path()))
+			files.push_back(entry.path());
+	std::sort(files.begin(), files.end());
+	return files;
+}
+
+std::vector<fs::path> readManifest(const fs::path& manifest)
+{
+	std::vector<fs::path> files;
+	std::ifstream list(manifest);
+	std::string line;
+	while (std::getline(list, line))
+	{
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if (line.empty())
+			continue;
+		fs::path path = fs::u8path(line);
+		files.push_back(path.is_absolute() ? path : manifest.parent_path() / path);
+	}
+	return files;
+}
+
+BatchReport runBatch(const BatchOptions& options)
+{
+	int cores = std::max(1u, std::thread::hardware_concurrency());
+	int decoders = options.decoders > 0 ? options.decoders : std::max(1, cores / 4);
+	int workers = options.workers > 0 ? options.workers : 2;
+	int encoders = options.encoders > 0 ? options.encoders : std::max(1, cores / 2);
+
+	BoundedQueue<Decoded> decoded(options.queueDepth);
+	BoundedQueue<Encoded> encoded(options.queueDepth);
+	std::atomic<std::size_t> next(0);
+	std::atomic<int> failed(0), written(0);
+	std::mutex logLock;
+	auto report = [&](const std::string& message)
+	{
+		std::lock_guard<std::mutex> guard(logLock);
+		std::cerr << message << std::endl;
+	};
+
+	std::thread decodeStage([&]
+	{
+		runThreads(decoders, [&]
+		{
+			for (std::size_t i = next++; i < options.inputs.size(); i = next++)
+			{
+				CGLAB_TRACE_SCOPE("decode", "stage");
+				QImage image;
+				if (!image.load(toQString(options.inputs[i])))
+				{
+					report("cannot read " + options.inputs[i].u8string());
+					failed++;
+					continue;
+				}
+				CGLAB_TRACE_ALLOCATED(image.sizeInBytes());
+				decoded.push({ i, std::move(image) });
+			}
+		});
+		decoded.close();
+	});
+
+	std::thread filterStage([&]
+	{
+		runThreads(workers, [&]
+		{
+			Decoded item;
+			while (decoded.pop(item))
+			{
+				fs::path dir = outputDir(options, options.inputs[item.index]);
+				for (const FilterSpec& spec : options.filters)
+				{
+					// An exception must not leave the thread, or std::terminate ends
+					// the whole batch; the file's other outputs still go ahead.
+					QImage result;
+					try
+					{
+						result = spec.build(item.image, options.structure)->process(item.image);
+					}
+					catch (const std::exception& error)
+					{
+						report("cannot filter " + options.inputs[item.index].u8string() + " with " + spec.label() + ": " + error.what());
+						failed++;
+						continue;
+					}
+					catch (...)
+					{
+						report("cannot filter " + options.inputs[item.index].u8string() + " with " + spec.label());
+						failed++;
+						continue;
+					}
+					encoded.push({ dir / (spec.label() + ".png"), std::move(result) });
+				}
+			}
+		});
+		encoded.close();
+	});
+
+	runThreads(encoders, [&]
+	{
+		Encoded item;
+		while (encoded.pop(item))
+		{
+			CGLAB_TRACE_SCOPE("encode", "stage");
+			std::error_code error;
+			fs::create_directories(item.path.parent_path(), error);
+			if (!item.image.save(toQString(item.path), "PNG"))
+			{
+				report("cannot write " + item.path.u8string());
+				failed++;
+				continue;
+			}
+			written++;
+		}
+	});
+	decodeStage.join();
+	filterStage.join();
+
+	BatchReport result;
+	result.images = int(options.inputs.size());
+	result.failed = failed;
+	result.written = written;
+	return result;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "filterspec.h"
+#include <filesystem>
+
+struct BatchOptions
+{
+	std::vector<std::filesystem::path> inputs;
+	// Outputs of an input go to outputRoot/<path relative to inputRoot without
+	// extension>/<label>.png. With no inputRoot they go to outputRoot/<label>.png.
+	std::filesystem::path inputRoot;
+	std::filesystem::path outputRoot = "Images";
+	std::vector<FilterSpec> filters;
+	// Structuring element for morphology specs without a radius.
+	Kernel* structure = nullptr;
+	// Threads per stage; 0 picks a default from the core count.
+	int decoders = 0, workers = 0, encoders = 0;
+	// Images waiting between two stages.
+	int queueDepth = 8;
+};
+
+struct BatchReport
+{
+	int images = 0;
+	int failed = 0;
+	int written = 0;
+};
+
+// Image files under dir, recursively, in a stable order.
+std::vector<std::filesystem::path> scanDirectory(const std::filesystem::path& dir);
+// Paths listed one per line; relative ones are taken relative to the manifest.
+std::vector<std::filesystem::path> readManifest(const std::filesystem::path& manifest);
+
+// Decodes, filters and PNG-encodes all inputs as three overlapping stages joined
+// by bounded queues. Several images are in flight at once, and each filter also
+// splits its image across the shared pool. Failures, including filters that
+// throw, are reported on stderr and counted per output; the batch goes on.
+BatchReport runBatch(const BatchOptions& options);
@@ -0,0 +1,279 @@
+#include "filterspec.h"
+#include "imagepool.h"
+#include "simd.h"
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <chrono>
+#include <cstdint>
+#include <map>
+
+// Throughput benchmark for every filter FilterSpec knows.
+// -s 1,4,16      image sizes in megapixels
+// -r 1,2,4,8     radii for Blur, Gaussian, Median, Dilation and Erosion
+// -t 1,0         thread counts (0: all cores)
+// -f Blur,Glass  filters to run (default: all)
+// -i image       tile this image to each size instead of synthetic input
+// -m seconds     minimum measuring time per case (default 0.5)
+// -o file        write the JSON results to file instead of stdout
+// -c baseline    compare with a stored JSON run and fail on regressions
+// -x fraction    slowdown that counts as a regression (default 0.1)
+
+namespace
+{
+	const char* const swept[] = { "Blur", "Gaussian", "Median", "Dilation", "Erosion" };
+
+	struct Options
+	{
+		std::vector<double> sizes = { 1, 4, 16 };
+		std::vector<double> radii = { 1, 2, 4, 8 };
+		std::vector<double> threads = { 1, 0 };
+		std::vector<std::string> filters;
+		std::string image, out, baseline;
+		double minSeconds = 0.5;
+		double threshold = 0.1;
+	};
+
+	std::vector<std::string> split(const std::string& list)
+	{
+		std::vector<std::string> parts;
+		std::size_t start = 0;
+		while (start <= list.size())
+		{
+			std::size_t next = std::min(list.find(',', start), list.size());
+			if (next > start)
+				parts.push_back(list.substr(start, next - start));
+			start = next + 1;
+		}
+		return parts;
+	}
+
+	std::vector<double> numbers(const std::string& list)
+	{
+		std::vector<double> values;
+		for (const std::string& part : split(list))
+			values.push_back(std::atof(part.c_str()));
+		return values;
+	}
+
+	// Deterministic mix of smooth gradients, edges and noise, so that no filter
+	// sees a degenerate (constant or sorted) input.
+	QImage synthetic(int w, int h)
+	{
+		QImage img(w, h, QImage::Format_ARGB32);
+		PixelSpan span(img);
+		forEachBand(h, [&](int begin, int end)
+		{
+			for (int y = begin; y < end; y++)
+			{
+				QRgb* row = span.row(y);
+				for (int x = 0; x < w; x++)
+				{
+					std::uint32_t n = std::uint32_t(x) * 0x9E3779B1u ^ std::uint32_t(y) * 0x85EBCA77u;
+					n ^= n >> 15;
+					n *= 0x2C1B3C6Du;
+					n ^= n >> 12;
+					int edge = ((x / 64 + y / 48) & 1) ? 96 : 0;
+					row[x] = qRgb((x * 255 / std::max(w - 1, 1) + edge) / 2 + (n & 63),
+						(y * 255 / std::max(h - 1, 1) + edge) / 2 + (n >> 8 & 63),
+						edge + (n >> 16 & 127));
+				}
+			}
+		});
+		return img;
+	}
+
+	QImage tiled(const QImage& tile, int w, int h)
+	{
+		QImage source = tile.convertToFormat(QImage::Format_ARGB32);
+		QImage img(w, h, QImage::Format_ARGB32);
+		PixelView src(source);
+		PixelSpan dst(img);
+		for (int y = 0; y < h; y++)
+			for (int x = 0; x < w; x++)
+				dst.row(y)[x] = src.at(x % src.width(), y % src.height());
+		return img;
+	}
+
+	// Best wall time of filter.process(img) after a warm-up run, repeated until
+	// minSeconds have been spent.
+	double bestSeconds(const Filter& filter, const QImage& img, double minSeconds, int& runs)
+	{
+		using Clock = std::chrono::steady_clock;
+		filter.process(img);
+		double best = 0, total = 0;
+		for (runs = 0; runs < 1000 && (runs == 0 || total < minSeconds); runs++)
+		{
+			Clock::time_point start = Clock::now();
+			QImage result = filter.process(img);
+			double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+			best = runs == 0 ? seconds : std::min(best, seconds);
+			total += seconds;
+		}
+		return best;
+	}
+
+	std::string keyOf(const QJsonObject& result)
+	{
+		return result["label"].toString().toStdString() + "@" + std::to_string(result["width"].toInt()) + "x"
+			+ std::to_string(result["height"].toInt()) + "/t" + std::to_string(result["threads"].toInt());
+	}
+
+	// Prints every case of current that is slower than in baseline by more than
+	// threshold and returns how many there are.
+	int compare(const QJsonArray& current, const QJsonArray& baseline, double threshold)
+	{
+		std::map<std::string, double> reference;
+		for (const QJsonValue& value : baseline)
+			reference[keyOf(value.toObject())] = value.toObject()["megapixelsPerSecond"].toDouble();
+
+		int regressions = 0, matched = 0;
+		for (const QJsonValue& value : current)
+		{
+			QJsonObject result = value.toObject();
+			std::string key = keyOf(result);
+			auto found = reference.find(key);
+			if (found == reference.end() || found->second <= 0)
+				continue;
+			matched++;
+			double now = result["megapixelsPerSecond"].toDouble();
+			double change = now / found->second - 1;
+			if (change < -threshold)
+			{
+				regressions++;
+				fprintf(stderr, "REGRESSION %-28s %9.1f -> %9.1f MP/s (%+.1f%%)\n", key.c_str(), found->second, now, change * 100);
+			}
+		}
+		fprintf(stderr, "%d of %d cases compared, %d regressions beyond %.0f%%\n", matched, int(current.size()), regressions, threshold * 100);
+		return regressions;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		std::string flag = argv[i], value = argv[i + 1];
+		if (flag == "-s")
+			options.sizes = numbers(value);
+		else if (flag == "-r")
+			options.radii = numbers(value);
+		else if (flag == "-t")
+			options.threads = numbers(value);
+		else if (flag == "-f")
+			options.filters = split(value);
+		else if (flag == "-i")
+			options.image = value;
+		else if (flag == "-m")
+			options.minSeconds = std::atof(value.c_str());
+		else if (flag == "-o")
+			options.out = value;
+		else if (flag == "-c")
+			options.baseline = value;
+		else if (flag == "-x")
+			options.threshold = std::atof(value.c_str());
+		else
+			continue;
+		i++;
+	}
+	if (options.filters.empty())
+		for (const std::string& name : FilterSpec::names())
+			if (name != "Source")
+				options.filters.push_back(name);
+
+	QImage tile;
+	if (!options.image.empty() && !tile.load(QString(options.image.c_str())))
+	{
+		fprintf(stderr, "cannot read %s\n", options.image.c_str());
+		return 1;
+	}
+
+	// Specs to run: swept filters once per radius, the others with defaults.
+	std::vector<std::pair<FilterSpec, int>> cases;
+	try
+	{
+		for (const std::string& name : options.filters)
+		{
+			FilterSpec plain(name);
+			bool radial = std::find_if(std::begin(swept), std::end(swept), [&](const char* s) { return plain.label() == s; }) != std::end(swept);
+			if (!radial)
+				cases.emplace_back(plain, -1);
+			else
+				for (double radius : options.radii)
+					cases.emplace_back(FilterSpec(plain.label() + ":" + std::to_string(int(radius))), int(radius));
+		}
+	}
+	catch (const std::invalid_argument& error)
+	{
+		fprintf(stderr, "%s\n", error.what());
+		return 1;
+	}
+
+	QJsonArray results;
+	for (double megapixels : options.sizes)
+	{
+		double pixels = megapixels * 1e6;
+		int w = std::max(1, int(std::lround(std::sqrt(pixels * 4 / 3))));
+		int h = std::max(1, int(std::lround(pixels / w)));
+		for (double threads : options.threads)
+		{
+			ThreadPool::setSharedThreadCount(std::size_t(threads));
+			int threadCount = int(ThreadPool::shared().threadCount());
+			QImage img = options.image.empty() ? synthetic(w, h) : tiled(tile, w, h);
+			for (const auto& item : cases)
+			{
+				std::unique_ptr<Filter> filter = item.first.build(img);
+				int runs = 0;
+				ImagePool::Counters before = ImagePool::shared().counters();
+				double seconds = bestSeconds(*filter, img, options.minSeconds, runs);
+				ImagePool::Counters after = ImagePool::shared().counters();
+				double rate = double(w) * h / 1e6 / seconds;
+
+				QJsonObject result;
+				result.insert("label", QString(item.first.label().c_str()));
+				if (item.second >= 0)
+					result.insert("radius", item.second);
+				result.insert("width", w);
+				result.insert("height", h);
+				result.insert("threads", threadCount);
+				result.insert("seconds", seconds);
+				result.insert("runs", runs);
+				result.insert("megapixelsPerSecond", rate);
+				// Misses beyond the first run mean buffers are not being recycled.
+				result.insert("poolHits", double(after.hits - before.hits));
+				result.insert("poolMisses", double(after.misses - before.misses));
+				results.append(result);
+				fprintf(stderr, "%-16s %6dx%-6d t%-3d %10.1f MP/s\n", item.first.label().c_str(), w, h, threadCount, rate);
+			}
+		}
+	}
+
+	QJsonObject report;
+	report.insert("simd", simdLevelName(simdLevel()));
+	report.insert("hardwareThreads", int(std::max(1u, std::thread::hardware_concurrency())));
+	report.insert("input", QString(options.image.empty() ? "synthetic" : options.image.c_str()));
+	report.insert("poolPeakBytes", double(ImagePool::shared().counters().peakBytes));
+	report.insert("results", results);
+	QByteArray json = QJsonDocument(report).toJson();
+	if (options.out.empty())
+		fwrite(json.constData(), 1, json.size(), stdout);
+	else
+	{
+		std::ofstream file(options.out, std::ios::binary);
+		file.write(json.constData(), json.size());
+	}
+
+	if (options.baseline.empty())
+		return 0;
+	std::ifstream file(options.baseline, std::ios::binary);
+	std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	QJsonParseError error;
+	QJsonDocument baseline = QJsonDocument::fromJson(QByteArray::fromStdString(text), &error);
+	if (error.error != QJsonParseError::NoError || !baseline.isObject())
+	{
+		fprintf(stderr, "cannot read baseline %s\n", options.baseline.c_str());
+		return 1;
+	}
+	return compare(results, baseline.object()["results"].toArray(), options.threshold) == 0 ? 0 : 1;
+}
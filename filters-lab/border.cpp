@@ -0,0 +1,74 @@
+#include "border.h"
+#include <algorithm>
+
+int Border::outside(int i, int n) const
+{
+	switch (mode)
+	{
+	case BorderMode::Mirror:
+	{
+		if (n == 1)
+			return 0;
+		int period = 2 * (n - 1);
+		i %= period;
+		if (i < 0)
+			i += period;
+		return i < n ? i : period - i;
+	}
+	case BorderMode::Wrap:
+		i %= n;
+		return i < 0 ? i + n : i;
+	case BorderMode::Constant:
+		return -1;
+	default:
+		return i < 0 ? 0 : n - 1;
+	}
+}
+
+QRgb Border::pixel(const PixelView& img, int x, int y) const
+{
+	int sx = index(x, img.width()), sy = index(y, img.height());
+	if (sx < 0 || sy < 0)
+		return constant;
+	return img.row(sy)[sx];
+}
+
+QColor Border::pixelColor(const QImage& img, int x, int y) const
+{
+	int sx = index(x, img.width()), sy = index(y, img.height());
+	if (sx < 0 || sy < 0)
+		return QColor(constant);
+	return img.pixelColor(sx, sy);
+}
+
+BorderedView::BorderedView(const PixelView& src, const Border& border) :
+	BorderedView(reinterpret_cast<const uchar*>(src.row(src.firstRow())), src.bytesPerLine(), src.firstRow(), src.width(), src.height(), border)
+{
+}
+
+BorderedView::BorderedView(const uchar* bits, qsizetype stride, int top, int width, int height, const Border& border) :
+	bits(bits), stride(stride), top(top), w(width), h(height), border(border)
+{
+	if (border.mode == BorderMode::Constant)
+	{
+		constantRow = ImagePool::shared().buffer(sizeof(QRgb) * std::max(w, 1));
+		std::fill(constantRow.as<QRgb>(), constantRow.as<QRgb>() + w, border.constant);
+	}
+}
+
+void BorderedView::fill(int y, int from, int to, QRgb* out) const
+{
+	const QRgb* in = row(y);
+	int left = std::min(std::max(from, 0), to), right = std::max(std::min(to, w), left);
+	for (int x = from; x < left; x++)
+	{
+		int i = border.index(x, w);
+		*out++ = i < 0 ? border.constant : in[i];
+	}
+	out = std::copy(in + left, in + right, out);
+	for (int x = right; x < to; x++)
+	{
+		int i = border.index(x, w);
+		*out++ = i < 0 ? border.constant : in[i];
+	}
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "imagepool.h"
+#include "pixelview.h"
+#include <QColor>
+
+// How the neighbourhood filters extend the source past its edges.
+enum class BorderMode
+{
+	Clamp,		// the nearest edge pixel
+	Mirror,		// reflected about the edge pixel, which is not repeated: c b | a b c
+	Wrap,		// the opposite edge, as if the image tiled the plane
+	Constant	// Border::constant
+};
+
+struct Border
+{
+	BorderMode mode = BorderMode::Clamp;
+	QRgb constant = 0xff000000u;
+
+	// Source index of coordinate i on an axis of n pixels, or -1 where the
+	// constant applies.
+	int index(int i, int n) const
+	{
+		if (unsigned(i) < unsigned(n))
+			return i;
+		return outside(i, n);
+	}
+	// Clamp and Mirror map a coordinate to a source pixel no farther away
+	// than the nearest edge, so a band only reads its halo rows. Wrap reads
+	// the opposite edge and needs the whole image.
+	bool isLocal() const
+	{
+		return mode != BorderMode::Wrap;
+	}
+	// Single pixels, for the per-pixel fallbacks.
+	QRgb pixel(const PixelView& img, int x, int y) const;
+	QColor pixelColor(const QImage& img, int x, int y) const;
+private:
+	int outside(int i, int n) const;
+};
+
+// Rows of a source extended by a Border. Rows outside the image map to a
+// source row or to a row of the constant colour. A windowed source works as
+// long as the rows asked for map into the window; for Clamp and Mirror that
+// holds for any row within the window's halo.
+class BorderedView
+{
+	const uchar* bits;
+	qsizetype stride;
+	int top, w, h;
+	Border border;
+	// width() pixels of the constant colour, for Constant only.
+	ImagePool::Buffer constantRow;
+public:
+	BorderedView(const PixelView& src, const Border& border);
+	// Rows [top, ...) of an image of the given height, stored at bits.
+	BorderedView(const uchar* bits, qsizetype stride, int top, int width, int height, const Border& border);
+
+	int width() const
+	{
+		return w;
+	}
+	int height() const
+	{
+		return h;
+	}
+	// Pixels [0, width()) of row y.
+	const QRgb* row(int y) const
+	{
+		int i = border.index(y, h);
+		return i < 0 ? constantRow.as<QRgb>() : reinterpret_cast<const QRgb*>(bits + (i - top) * stride);
+	}
+	// Writes pixels [from, to) of row y to out. The part inside the image is
+	// one copy; only the pixels past the edges are mapped one by one.
+	void fill(int y, int from, int to, QRgb* out) const;
+	// Pixels [from, to) of row y: straight from the source when the span is
+	// inside the image, else filled into scratch.
+	const QRgb* span(int y, int from, int to, QRgb* scratch) const
+	{
+		if (from >= 0 && to <= w)
+			return row(y) + from;
+		fill(y, from, to, scratch);
+		return scratch;
+	}
+};
@@ -0,0 +1,51 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// Blocking FIFO with a fixed capacity between the stages of a producer/consumer
+// pipeline. A full queue stalls its producers, so memory stays bounded.
+template <class T>
+class BoundedQueue
+{
+	std::mutex lock;
+	std::condition_variable notFull, notEmpty;
+	std::deque<T> items;
+	std::size_t capacity;
+	bool closed = false;
+public:
+	explicit BoundedQueue(std::size_t capacity) : capacity(std::max<std::size_t>(capacity, 1)) {}
+
+	// Blocks while the queue is full. Returns false if it has been closed.
+	bool push(T item)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		notFull.wait(guard, [this] { return closed || items.size() < capacity; });
+		if (closed)
+			return false;
+		items.push_back(std::move(item));
+		notEmpty.notify_one();
+		return true;
+	}
+	// Blocks while the queue is empty. Returns false once it is closed and drained.
+	bool pop(T& item)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		notEmpty.wait(guard, [this] { return closed || !items.empty(); });
+		if (items.empty())
+			return false;
+		item = std::move(items.front());
+		items.pop_front();
+		notFull.notify_one();
+		return true;
+	}
+	// No more items will be pushed; consumers drain what is left.
+	void close()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		closed = true;
+		notFull.notify_all();
+		notEmpty.notify_all();
+	}
+};
@@ -0,0 +1,767 @@
+#include "convolution.h"
+#include "simd.h"
+#include "fft.h"
+#include "imagepool.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(CGLAB_X86)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+	inline int toChannel(float value)
+	{
+		if (value > 255.f)
+			return 255;
+		if (value < 0.f)
+			return 0;
+		return int(value);
+	}
+}
+
+void convolveSeparable(const PixelView& src, const PixelSpan& dst, int begin, int end,
+	const float* horizontal, const float* vertical, int radius, const Border& border)
+{
+	int w = src.width();
+	int size = 2 * radius + 1;
+	BorderedView rows(src, border);
+	ImagePool::Buffer lineBuffer = ImagePool::shared().buffer(sizeof(QRgb) * (w + 2 * radius));
+	QRgb* line = lineBuffer.as<QRgb>();
+	ImagePool::Buffer paddedBuffer = ImagePool::shared().buffer(sizeof(float) * 3 * (w + 2 * radius));
+	float* padded = paddedBuffer.as<float>();
+	ImagePool::Buffer ringBuffer = ImagePool::shared().buffer(sizeof(float) * 3 * w * size);
+	float* ring = ringBuffer.as<float>();
+	ImagePool::Buffer accBuffer = ImagePool::shared().buffer(sizeof(float) * 3 * w);
+	float* acc = accBuffer.as<float>();
+
+	auto slot = [&](int y)
+	{
+		return &ring[3 * w * (((y % size) + size) % size)];
+	};
+	auto filterRow = [&](int y)
+	{
+		const QRgb* in = rows.span(y, -radius, w + radius, line);
+		for (int x = 0; x < w + 2 * radius; x++)
+		{
+			QRgb color = in[x];
+			float* p = &padded[3 * x];
+			p[0] = qRed(color);
+			p[1] = qGreen(color);
+			p[2] = qBlue(color);
+		}
+		float* out = slot(y);
+		for (int x = 0; x < w; x++)
+		{
+			const float* p = &padded[3 * x];
+			float r = 0, g = 0, b = 0;
+			for (int j = 0; j < size; j++)
+			{
+				r += p[3 * j] * horizontal[j];
+				g += p[3 * j + 1] * horizontal[j];
+				b += p[3 * j + 2] * horizontal[j];
+			}
+			out[3 * x] = r;
+			out[3 * x + 1] = g;
+			out[3 * x + 2] = b;
+		}
+	};
+
+	for (int y = begin - radius; y < begin + radius; y++)
+		filterRow(y);
+	for (int y = begin; y < end; y++)
+	{
+		filterRow(y + radius);
+		std::fill(acc, acc + 3 * w, 0.f);
+		for (int i = 0; i < size; i++)
+		{
+			const float* in = slot(y - radius + i);
+			float k = vertical[i];
+			for (int n = 0; n < 3 * w; n++)
+				acc[n] += in[n] * k;
+		}
+		QRgb* out = dst.row(y);
+		for (int x = 0; x < w; x++)
+			out[x] = qRgb(toChannel(acc[3 * x]), toChannel(acc[3 * x + 1]), toChannel(acc[3 * x + 2]));
+	}
+}
+
+namespace
+{
+	// Weights quantised for the Fixed16 kernels: fixed[t] / 2^shift
+	// approximates weights[t]. Returns shift.
+	int quantise(const float* weights, int count, short* fixed)
+	{
+		float peak = 0, total = 0;
+		for (int t = 0; t < count; t++)
+		{
+			peak = std::max(peak, std::fabs(weights[t]));
+			total += std::fabs(weights[t]);
+		}
+		// Largest scale that keeps every weight in int16 and the worst-case
+		// sum of 255 * |q| inside int32.
+		int shift = 15;
+		while (shift > 0 && (std::lround(peak * (1 << shift)) > 32767 ||
+			255.0 * total * (1 << shift) > 2147483647.0))
+			shift--;
+		for (int t = 0; t < count; t++)
+			fixed[t] = short(std::lround(weights[t] * (1 << shift)));
+		return shift;
+	}
+
+	typedef void (*FloatRowKernel)(const uchar* const* taps, const float* weights, int tapCount, uchar* out, int begin, int end);
+	typedef void (*FixedRowKernel)(const uchar* const* taps, const short* weights, int tapCount, int shift, uchar* out, int begin, int end);
+
+	void floatRowScalar(const uchar* const* taps, const float* weights, int tapCount, uchar* out, int begin, int end)
+	{
+		for (int n = begin; n < end; n++)
+		{
+			float acc = 0;
+			for (int t = 0; t < tapCount; t++)
+				acc += taps[t][n] * weights[t];
+			out[n] = toChannel(acc);
+		}
+	}
+
+	void fixedRowScalar(const uchar* const* taps, const short* weights, int tapCount, int shift, uchar* out, int begin, int end)
+	{
+		for (int n = begin; n < end; n++)
+		{
+			int acc = 0;
+			for (int t = 0; t < tapCount; t++)
+				acc += taps[t][n] * weights[t];
+			acc >>= shift;
+			out[n] = acc < 0 ? 0 : (acc > 255 ? 255 : acc);
+		}
+	}
+
+#if defined(CGLAB_X86)
+	// Pairs of int16 weights broadcast for pmaddwd: low half multiplies the
+	// first tap of the pair, high half the second.
+	inline int weightPair(const short* weights, int t, int tapCount)
+	{
+		int second = t + 1 < tapCount ? weights[t + 1] : 0;
+		return int((unsigned(second) << 16) | unsigned(static_cast<unsigned short>(weights[t])));
+	}
+
+	// Each step covers Blocks vector-widths of bytes, so that every weight
+	// broadcast and tap pointer load feeds Blocks times as many pixels and the
+	// independent accumulators hide the add latency. The row kernels take
+	// steps of two blocks, then one, then hand the tail to the next narrower
+	// kernel. Lanes are summed in the same order at every width.
+
+	// Blocks of 16 bytes (4 pixels).
+	template <int Blocks>
+	CGLAB_TARGET("sse4.1")
+	inline void floatStepSSE41(const uchar* const* taps, const float* weights, int tapCount, uchar* out, int n)
+	{
+		const __m128 zero = _mm_setzero_ps(), top = _mm_set1_ps(255.f);
+		__m128 a[4 * Blocks];
+		CGLAB_UNROLL
+		for (int k = 0; k < 4 * Blocks; k++)
+			a[k] = zero;
+		for (int t = 0; t < tapCount; t++)
+		{
+			__m128 w = _mm_set1_ps(weights[t]);
+			CGLAB_UNROLL
+			for (int b = 0; b < Blocks; b++)
+			{
+				__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(taps[t] + n + 16 * b));
+				a[4 * b] = _mm_add_ps(a[4 * b], _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(bytes)), w));
+				a[4 * b + 1] = _mm_add_ps(a[4 * b + 1], _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(bytes, 4))), w));
+				a[4 * b + 2] = _mm_add_ps(a[4 * b + 2], _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(bytes, 8))), w));
+				a[4 * b + 3] = _mm_add_ps(a[4 * b + 3], _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(bytes, 12))), w));
+			}
+		}
+		CGLAB_UNROLL
+		for (int b = 0; b < Blocks; b++)
+		{
+			__m128i i0 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(a[4 * b], zero), top));
+			__m128i i1 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(a[4 * b + 1], zero), top));
+			__m128i i2 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(a[4 * b + 2], zero), top));
+			__m128i i3 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(a[4 * b + 3], zero), top));
+			__m128i packed = _mm_packus_epi16(_mm_packs_epi32(i0, i1), _mm_packs_epi32(i2, i3));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + n + 16 * b), packed);
+		}
+	}
+
+	template <int Blocks>
+	CGLAB_TARGET("sse4.1")
+	inline void fixedStepSSE41(const uchar* const* taps, const short* weights, int tapCount, int shift, uchar* out, int n)
+	{
+		__m128i a[4 * Blocks];
+		CGLAB_UNROLL
+		for (int k = 0; k < 4 * Blocks; k++)
+			a[k] = _mm_setzero_si128();
+		for (int t = 0; t < tapCount; t += 2)
+		{
+			const uchar* second = t + 1 < tapCount ? taps[t + 1] : taps[t];
+			__m128i w = _mm_set1_epi32(weightPair(weights, t, tapCount));
+			CGLAB_UNROLL
+			for (int b = 0; b < Blocks; b++)
+			{
+				__m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(taps[t] + n + 16 * b));
+				__m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(second + n + 16 * b));
+				__m128i lo1 = _mm_cvtepu8_epi16(first), hi1 = _mm_cvtepu8_epi16(_mm_srli_si128(first, 8));
+				__m128i lo2 = _mm_cvtepu8_epi16(next), hi2 = _mm_cvtepu8_epi16(_mm_srli_si128(next, 8));
+				a[4 * b] = _mm_add_epi32(a[4 * b], _mm_madd_epi16(_mm_unpacklo_epi16(lo1, lo2), w));
+				a[4 * b + 1] = _mm_add_epi32(a[4 * b + 1], _mm_madd_epi16(_mm_unpackhi_epi16(lo1, lo2), w));
+				a[4 * b + 2] = _mm_add_epi32(a[4 * b + 2], _mm_madd_epi16(_mm_unpacklo_epi16(hi1, hi2), w));
+				a[4 * b + 3] = _mm_add_epi32(a[4 * b + 3], _mm_madd_epi16(_mm_unpackhi_epi16(hi1, hi2), w));
+			}
+		}
+		__m128i s = _mm_cvtsi32_si128(shift);
+		CGLAB_UNROLL
+		for (int b = 0; b < Blocks; b++)
+		{
+			__m128i packed = _mm_packus_epi16(_mm_packs_epi32(_mm_sra_epi32(a[4 * b], s), _mm_sra_epi32(a[4 * b + 1], s)),
+				_mm_packs_epi32(_mm_sra_epi32(a[4 * b + 2], s), _mm_sra_epi32(a[4 * b + 3], s)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + n + 16 * b), packed);
+		}
+	}
+
+	// Blocks of 32 bytes (8 pixels).
+	template <int Blocks>
+	CGLAB_TARGET("avx2")
+	inline void floatStepAVX2(const uchar* const* taps, const float* weights, int tapCount, uchar* out, int n)
+	{
+		const __m256 zero = _mm256_setzero_ps(), top = _mm256_set1_ps(255.f);
+		const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+		__m256 a[4 * Blocks];
+		CGLAB_UNROLL
+		for (int k = 0; k < 4 * Blocks; k++)
+			a[k] = zero;
+		for (int t = 0; t < tapCount; t++)
+		{
+			__m256 w = _mm256_set1_ps(weights[t]);
+			CGLAB_UNROLL
+			for (int k = 0; k < 4 * Blocks; k++)
+			{
+				__m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(taps[t] + n + 8 * k));
+				a[k] = _mm256_add_ps(a[k], _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes)), w));
+			}
+		}
+		CGLAB_UNROLL
+		for (int b = 0; b < Blocks; b++)
+		{
+			__m256i i0 = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(a[4 * b], zero), top));
+			__m256i i1 = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(a[4 * b + 1], zero), top));
+			__m256i i2 = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(a[4 * b + 2], zero), top));
+			__m256i i3 = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(a[4 * b + 3], zero), top));
+			__m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(i0, i1), _mm256_packs_epi32(i2, i3));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + n + 32 * b), _mm256_permutevar8x32_epi32(packed, order));
+		}
+	}
+
+	template <int Blocks>
+	CGLAB_TARGET("avx2")
+	inline void fixedStepAVX2(const uchar* const* taps, const short* weights, int tapCount, int shift, uchar* out, int n)
+	{
+		__m256i a[4 * Blocks];
+		CGLAB_UNROLL
+		for (int k = 0; k < 4 * Blocks; k++)
+			a[k] = _mm256_setzero_si256();
+		for (int t = 0; t < tapCount; t += 2)
+		{
+			const uchar* first = taps[t];
+			const uchar* second = t + 1 < tapCount ? taps[t + 1] : taps[t];
+			__m256i w = _mm256_set1_epi32(weightPair(weights, t, tapCount));
+			CGLAB_UNROLL
+			for (int b = 0; b < Blocks; b++)
+			{
+				__m256i lo1 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(first + n + 32 * b)));
+				__m256i hi1 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(first + n + 32 * b + 16)));
+				__m256i lo2 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(second + n + 32 * b)));
+				__m256i hi2 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(second + n + 32 * b + 16)));
+				a[4 * b] = _mm256_add_epi32(a[4 * b], _mm256_madd_epi16(_mm256_unpacklo_epi16(lo1, lo2), w));
+				a[4 * b + 1] = _mm256_add_epi32(a[4 * b + 1], _mm256_madd_epi16(_mm256_unpackhi_epi16(lo1, lo2), w));
+				a[4 * b + 2] = _mm256_add_epi32(a[4 * b + 2], _mm256_madd_epi16(_mm256_unpacklo_epi16(hi1, hi2), w));
+				a[4 * b + 3] = _mm256_add_epi32(a[4 * b + 3], _mm256_madd_epi16(_mm256_unpackhi_epi16(hi1, hi2), w));
+			}
+		}
+		__m128i s = _mm_cvtsi32_si128(shift);
+		CGLAB_UNROLL
+		for (int b = 0; b < Blocks; b++)
+		{
+			__m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(_mm256_sra_epi32(a[4 * b], s), _mm256_sra_epi32(a[4 * b + 1], s)),
+				_mm256_packs_epi32(_mm256_sra_epi32(a[4 * b + 2], s), _mm256_sra_epi32(a[4 * b + 3], s)));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + n + 32 * b), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+		}
+	}
+
+	// Blocks of 64 bytes (16 pixels). Explicit rounding keeps the compiler
+	// from contracting into FMA, which AVX-512 always has.
+	template <int Blocks>
+	CGLAB_TARGET("avx512f")
+	inline void floatStepAVX512(const uchar* const* taps, const float* weights, int tapCount, uchar* out, int n)
+	{
+		const __m512 zero = _mm512_setzero_ps(), top = _mm512_set1_ps(255.f);
+		const int exact = _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+		__m512 a[4 * Blocks];
+		CGLAB_UNROLL
+		for (int k = 0; k < 4 * Blocks; k++)
+			a[k] = zero;
+		for (int t = 0; t < tapCount; t++)
+		{
+			__m512 w = _mm512_set1_ps(weights[t]);
+			CGLAB_UNROLL
+			for (int k = 0; k < 4 * Blocks; k++)
+			{
+				__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(taps[t] + n + 16 * k));
+				a[k] = _mm512_add_round_ps(a[k], _mm512_mul_round_ps(_mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(bytes)), w, exact), exact);
+			}
+		}
+		CGLAB_UNROLL
+		for (int k = 0; k < 4 * Blocks; k++)
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + n + 16 * k), _mm512_cvtepi32_epi8(_mm512_cvttps_epi32(_mm512_min_ps(_mm512_max_ps(a[k], zero), top))));
+	}
+
+	CGLAB_TARGET("sse4.1")
+	void floatRowSSE41(const uchar* const* taps, const float* weights, int tapCount, uchar* out, int begin, int end)
+	{
+		int n = begin;
+		for (; n + 32 <= end; n += 32)
+			floatStepSSE41<2>(taps, weights, tapCount, out, n);
+		for (; n + 16 <= end; n += 16)
+			floatStepSSE41<1>(taps, weights, tapCount, out, n);
+		floatRowScalar(taps, weights, tapCount, out, n, end);
+	}
+
+	CGLAB_TARGET("sse4.1")
+	void fixedRowSSE41(const uchar* const* taps, const short* weights, int tapCount, int shift, uchar* out, int begin, int end)
+	{
+		int n = begin;
+		for (; n + 32 <= end; n += 32)
+			fixedStepSSE41<2>(taps, weights, tapCount, shift, out, n);
+		for (; n + 16 <= end; n += 16)
+			fixedStepSSE41<1>(taps, weights, tapCount, shift, out, n);
+		fixedRowScalar(taps, weights, tapCount, shift, out, n, end);
+	}
+
+	CGLAB_TARGET("avx2")
+	void floatRowAVX2(const uchar* const* taps, const float* weights, int tapCount, uchar* out, int begin, int end)
+	{
+		int n = begin;
+		for (; n + 64 <= end; n += 64)
+			floatStepAVX2<2>(taps, weights, tapCount, out, n);
+		for (; n + 32 <= end; n += 32)
+			floatStepAVX2<1>(taps, weights, tapCount, out, n);
+		floatRowSSE41(taps, weights, tapCount, out, n, end);
+	}
+
+	CGLAB_TARGET("avx2")
+	void fixedRowAVX2(const uchar* const* taps, const short* weights, int tapCount, int shift, uchar* out, int begin, int end)
+	{
+		int n = begin;
+		for (; n + 64 <= end; n += 64)
+			fixedStepAVX2<2>(taps, weights, tapCount, shift, out, n);
+		for (; n + 32 <= end; n += 32)
+			fixedStepAVX2<1>(taps, weights, tapCount, shift, out, n);
+		fixedRowSSE41(taps, weights, tapCount, shift, out, n, end);
+	}
+
+	// The Fixed16 path reuses the AVX2 kernel, since 512-bit pmaddwd would
+	// need AVX-512BW on top of the F subset.
+	CGLAB_TARGET("avx512f")
+	void floatRowAVX512(const uchar* const* taps, const float* weights, int tapCount, uchar* out, int begin, int end)
+	{
+		int n = begin;
+		for (; n + 128 <= end; n += 128)
+			floatStepAVX512<2>(taps, weights, tapCount, out, n);
+		for (; n + 64 <= end; n += 64)
+			floatStepAVX512<1>(taps, weights, tapCount, out, n);
+		floatRowAVX2(taps, weights, tapCount, out, n, end);
+	}
+#endif
+
+	FloatRowKernel floatRowKernel()
+	{
+		switch (simdLevel())
+		{
+#if defined(CGLAB_X86)
+		case SimdLevel::AVX512:
+			return floatRowAVX512;
+		case SimdLevel::AVX2:
+			return floatRowAVX2;
+		case SimdLevel::SSE41:
+			return floatRowSSE41;
+#endif
+		default:
+			return floatRowScalar;
+		}
+	}
+
+	FixedRowKernel fixedRowKernel()
+	{
+		switch (simdLevel())
+		{
+#if defined(CGLAB_X86)
+		case SimdLevel::AVX512:
+		case SimdLevel::AVX2:
+			return fixedRowAVX2;
+		case SimdLevel::SSE41:
+			return fixedRowSSE41;
+#endif
+		default:
+			return fixedRowScalar;
+		}
+	}
+}
+
+float fixedPointErrorBound(const float* kernel, int radius)
+{
+	int len = (2 * radius + 1) * (2 * radius + 1);
+	std::vector<short> fixed(len);
+	int shift = quantise(kernel, len, fixed.data());
+	double error = 0;
+	for (int t = 0; t < len; t++)
+		error += std::fabs(kernel[t] - double(fixed[t]) / (1 << shift));
+	return float(255.0 * error + 1.0);
+}
+
+void convolveDirect(const PixelView& src, const PixelSpan& dst, int begin, int end,
+	const float* kernel, int radius, ConvolutionPrecision precision, const Border& border)
+{
+	int w = src.width();
+	int size = 2 * radius + 1;
+	int rowPixels = w + 2 * radius;
+	BorderedView rows(src, border);
+	ImagePool::Buffer ringBuffer = ImagePool::shared().buffer(sizeof(QRgb) * rowPixels * size);
+	QRgb* ring = ringBuffer.as<QRgb>();
+
+	auto slot = [&](int y)
+	{
+		return &ring[rowPixels * (((y % size) + size) % size)];
+	};
+	auto padRow = [&](int y)
+	{
+		rows.fill(y, -radius, w + radius, slot(y));
+	};
+
+	// The non-zero taps: position, weight in both precisions and, per row,
+	// where they read in the ring.
+	int len = size * size;
+	ImagePool::Buffer positionBuffer = ImagePool::shared().buffer(2 * sizeof(int) * len);
+	int* tapRow = positionBuffer.as<int>();
+	int* tapCol = tapRow + len;
+	ImagePool::Buffer weightBuffer = ImagePool::shared().buffer(sizeof(float) * len);
+	float* weights = weightBuffer.as<float>();
+	int tapCount = 0;
+	for (int i = 0; i < size; i++)
+		for (int j = 0; j < size; j++)
+			if (kernel[i * size + j] != 0.f)
+			{
+				tapRow[tapCount] = i;
+				tapCol[tapCount] = j;
+				weights[tapCount++] = kernel[i * size + j];
+			}
+	ImagePool::Buffer fixedBuffer = ImagePool::shared().buffer(sizeof(short) * len);
+	short* fixed = fixedBuffer.as<short>();
+	int shift = quantise(weights, tapCount, fixed);
+	FloatRowKernel floatRow = floatRowKernel();
+	FixedRowKernel fixedRow = fixedRowKernel();
+	ImagePool::Buffer tapBuffer = ImagePool::shared().buffer(sizeof(const uchar*) * len);
+	const uchar** taps = tapBuffer.as<const uchar*>();
+
+	for (int y = begin - radius; y < begin + radius; y++)
+		padRow(y);
+	for (int y = begin; y < end; y++)
+	{
+		padRow(y + radius);
+		for (int t = 0; t < tapCount; t++)
+			taps[t] = reinterpret_cast<const uchar*>(slot(y - radius + tapRow[t]) + tapCol[t]);
+		QRgb* out = dst.row(y);
+		uchar* bytes = reinterpret_cast<uchar*>(out);
+		if (precision == ConvolutionPrecision::Fixed16)
+			fixedRow(taps, fixed, tapCount, shift, bytes, 0, 4 * w);
+		else
+			floatRow(taps, weights, tapCount, bytes, 0, 4 * w);
+		for (int x = 0; x < w; x++)
+			out[x] |= 0xff000000u;
+	}
+}
+
+void boxBlur(const PixelView& src, const PixelSpan& dst, int begin, int end, int radius, int passes, const Border& border)
+{
+	int w = src.width(), h = src.height();
+	int stride = 3 * w;
+	int size = 2 * radius + 1;
+	double area = double(size) * size;
+	// Wrap extends the image periodically, and so does every pass, so the
+	// band holds its halo unclipped and the vertical sums need no border.
+	bool periodic = border.mode == BorderMode::Wrap;
+	int reach = radius * passes;
+	int top = periodic ? begin - reach : std::max(0, begin - reach);
+	int bottom = periodic ? end + reach : std::min(h, end + reach);
+	BorderedView rows(src, border);
+
+	// Rows [top, bottom) as float channels; both buffers are indexed by y - top.
+	std::size_t bytes = sizeof(float) * stride * (bottom - top);
+	ImagePool::Buffer first = ImagePool::shared().buffer(bytes), second = ImagePool::shared().buffer(bytes);
+	float* cur = first.as<float>();
+	float* next = second.as<float>();
+	// A row with radius padded pixels on each side, and one more on the
+	// right for the last step of the sliding sum.
+	ImagePool::Buffer lineBuffer = ImagePool::shared().buffer(sizeof(double) * 3 * (w + 2 * radius + 1));
+	double* line = lineBuffer.as<double>();
+	ImagePool::Buffer sumsBuffer = ImagePool::shared().buffer(sizeof(double) * stride);
+	double* sums = sumsBuffer.as<double>();
+	// The constant colour, and a row of it after a horizontal pass.
+	const float constant[3] = { float(qRed(border.constant)), float(qGreen(border.constant)), float(qBlue(border.constant)) };
+	ImagePool::Buffer constantBuffer = ImagePool::shared().buffer(sizeof(float) * stride);
+	float* constantRow = constantBuffer.as<float>();
+	for (int n = 0; n < stride; n++)
+		constantRow[n] = constant[n % 3] * size;
+	for (int y = top; y < bottom; y++)
+	{
+		const QRgb* in = rows.row(y);
+		float* out = &cur[stride * (y - top)];
+		for (int x = 0; x < w; x++)
+		{
+			out[3 * x] = qRed(in[x]);
+			out[3 * x + 1] = qGreen(in[x]);
+			out[3 * x + 2] = qBlue(in[x]);
+		}
+	}
+
+	// Rows the next horizontal pass has to filter: the ones the previous
+	// vertical pass produced.
+	int validTop = top, validBottom = bottom;
+	for (int pass = 1; pass <= passes; pass++)
+	{
+		// Horizontal sums from cur into next. Neither stage writes the buffer
+		// it reads, so each pass sees only what the previous pass finished.
+		for (int y = validTop; y < validBottom; y++)
+		{
+			const float* row = &cur[stride * (y - top)];
+			float* sumRow = &next[stride * (y - top)];
+			std::copy(row, row + stride, line + 3 * radius);
+			for (int x = -radius; x < 0; x++)
+			{
+				int i = border.index(x, w);
+				for (int c = 0; c < 3; c++)
+					line[3 * (x + radius) + c] = i < 0 ? constant[c] : row[3 * i + c];
+			}
+			for (int x = w; x < w + radius; x++)
+			{
+				int i = border.index(x, w);
+				for (int c = 0; c < 3; c++)
+					line[3 * (x + radius) + c] = i < 0 ? constant[c] : row[3 * i + c];
+			}
+			for (int c = 0; c < 3; c++)
+			{
+				double sum = 0;
+				for (int j = 0; j < size; j++)
+					sum += line[3 * j + c];
+				for (int x = 0; x < w; x++)
+				{
+					sumRow[3 * x + c] = float(sum);
+					sum += line[3 * (x + size) + c] - line[3 * x + c];
+				}
+			}
+		}
+
+		// Vertical sums from next back into cur, for the rows later passes
+		// still need. Clamped and
+		// mirrored rows lie no farther than radius from the row that reads
+		// them, so they stay inside the rows the previous pass produced.
+		int outTop = begin - radius * (passes - pass), outBottom = end + radius * (passes - pass);
+		if (!periodic)
+		{
+			outTop = std::max(0, outTop);
+			outBottom = std::min(h, outBottom);
+		}
+		auto row = [&](int y) -> const float*
+		{
+			if (periodic)
+				return &next[stride * (y - top)];
+			int i = border.index(y, h);
+			return i < 0 ? constantRow : &next[stride * (i - top)];
+		};
+		std::fill(sums, sums + stride, 0.0);
+		for (int i = -radius; i <= radius; i++)
+		{
+			const float* in = row(outTop + i);
+			for (int n = 0; n < stride; n++)
+				sums[n] += in[n];
+		}
+		for (int y = outTop; y < outBottom; y++)
+		{
+			float* out = &cur[stride * (y - top)];
+			for (int n = 0; n < stride; n++)
+				out[n] = float(sums[n] / area);
+			if (y + 1 == outBottom)
+				break;
+			const float* add = row(y + radius + 1);
+			const float* sub = row(y - radius);
+			for (int n = 0; n < stride; n++)
+				sums[n] += add[n] - sub[n];
+		}
+		validTop = outTop;
+		validBottom = outBottom;
+	}
+
+	for (int y = begin; y < end; y++)
+	{
+		const float* in = &cur[stride * (y - top)];
+		QRgb* out = dst.row(y);
+		for (int x = 0; x < w; x++)
+			out[x] = qRgb(toChannel(in[3 * x]), toChannel(in[3 * x + 1]), toChannel(in[3 * x + 2]));
+	}
+}
+
+namespace
+{
+	// Tile with the least transform work for a width x rows block: every tile
+	// yields (tile - 2 radius)^2 outputs and costs about n log n for its n pixels.
+	int tileSize(int outputs, int radius)
+	{
+		int best = 0;
+		double bestCost = 0;
+		// Tiles past 512 rarely pay off, but a kernel wider than that needs one.
+		int smallest = Fft::sizeFor(2 * radius + 2);
+		for (int size = smallest; size <= std::max(512, smallest); size <<= 1)
+		{
+			int tiles = (outputs + size - 2 * radius - 1) / (size - 2 * radius);
+			double cost = double(tiles) * size * std::log2(double(size));
+			if (!best || cost < bestCost)
+			{
+				best = size;
+				bestCost = cost;
+			}
+			if (size - 2 * radius >= outputs)
+				break;
+		}
+		return best;
+	}
+
+	// A tile of one channel: origin of its outputs and the channel's bit offset.
+	struct Plane
+	{
+		int x, y, shift;
+	};
+}
+
+bool prefersFFT(const float* kernel, int radius)
+{
+	int size = 2 * radius + 1;
+	int taps = 0;
+	for (int t = 0; t < size * size; t++)
+		taps += kernel[t] != 0.f;
+	return taps >= FftMinTaps;
+}
+
+FftKernel::FftKernel(const float* kernel, int radius) :
+	taps(kernel, kernel + (2 * radius + 1) * (2 * radius + 1)), r(radius)
+{
+}
+
+const Complex* FftKernel::spectrum(int tileW, int tileH) const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	std::vector<Complex>& spectrum = spectra[std::make_pair(tileW, tileH)];
+	if (!spectrum.empty())
+		return spectrum.data();
+
+	// MatrixFilter correlates, so tap (i, j) goes to (-i, -j) mod the tile,
+	// scaled for the unnormalised inverse.
+	int size = 2 * r + 1;
+	double area = double(tileW) * tileH;
+	spectrum.assign(std::size_t(tileW) * tileH, Complex());
+	for (int i = 0; i < size; i++)
+		for (int j = 0; j < size; j++)
+		{
+			int y = (tileH - (i - r)) % tileH, x = (tileW - (j - r)) % tileW;
+			spectrum[std::size_t(y) * tileW + x] = taps[i * size + j] / area;
+		}
+	Fft2D(tileW, tileH).forward(spectrum.data());
+	return spectrum.data();
+}
+
+void convolveFFT(const PixelView& src, const PixelSpan& dst, int begin, int end, const float* kernel, int radius,
+	const Border& border)
+{
+	convolveFFT(src, dst, begin, end, FftKernel(kernel, radius), border);
+}
+
+void convolveFFT(const PixelView& src, const PixelSpan& dst, int begin, int end, const FftKernel& kernel,
+	const Border& border)
+{
+	int w = src.width();
+	int radius = kernel.radius();
+	int tileW = tileSize(w, radius), tileH = tileSize(end - begin, radius);
+	int stepX = tileW - 2 * radius, stepY = tileH - 2 * radius;
+	std::size_t area = std::size_t(tileW) * tileH;
+	Fft2D fft(tileW, tileH);
+	const Complex* spectrum = kernel.spectrum(tileW, tileH);
+
+	// Three channels of every tile in the band, two real planes per transform.
+	std::size_t planeCount = 3 * std::size_t((end - begin + stepY - 1) / stepY) * ((w + stepX - 1) / stepX);
+	ImagePool::Buffer planeBuffer = ImagePool::shared().buffer(sizeof(Plane) * planeCount);
+	Plane* planes = planeBuffer.as<Plane>();
+	std::size_t planeIndex = 0;
+	for (int y = begin; y < end; y += stepY)
+		for (int x = 0; x < w; x += stepX)
+			for (int shift = 16; shift >= 0; shift -= 8)
+				planes[planeIndex++] = { x, y, shift };
+
+	// Source rows past end + radius only reach outputs outside the band, and
+	// columns past w + radius outputs outside the image: both are zeroed.
+	ImagePool::Buffer blockBuffer = ImagePool::shared().buffer(sizeof(Complex) * area);
+	Complex* block = blockBuffer.as<Complex>();
+	BorderedView rows(src, border);
+	ImagePool::Buffer lineBuffer = ImagePool::shared().buffer(sizeof(QRgb) * tileW);
+	QRgb* line = lineBuffer.as<QRgb>();
+	auto load = [&](const Plane& plane, bool imaginary)
+	{
+		int from = plane.x - radius, to = std::min(from + tileW, w + radius);
+		for (int ty = 0; ty < tileH; ty++)
+		{
+			Complex* out = &block[std::size_t(ty) * tileW];
+			int y = plane.y - radius + ty;
+			const QRgb* in = y < end + radius ? rows.span(y, from, to, line) : nullptr;
+			for (int tx = 0; tx < tileW; tx++)
+			{
+				double value = in && tx < to - from ? double((in[tx] >> plane.shift) & 0xff) : 0.0;
+				if (imaginary)
+					out[tx].imag(value);
+				else
+					out[tx] = Complex(value, 0.0);
+			}
+		}
+	};
+	// Rounding to float first truncates like the direct path: the FFT result is
+	// within 1e-9 of the exact sum.
+	auto store = [&](const Plane& plane, bool imaginary)
+	{
+		for (int ty = radius; ty < radius + stepY && plane.y + ty - radius < end; ty++)
+		{
+			const Complex* in = &block[std::size_t(ty) * tileW];
+			QRgb* out = dst.row(plane.y + ty - radius);
+			for (int tx = radius; tx < radius + stepX && plane.x + tx - radius < w; tx++)
+			{
+				QRgb& pixel = out[plane.x + tx - radius];
+				QRgb value = QRgb(toChannel(float(imaginary ? in[tx].imag() : in[tx].real()))) << plane.shift;
+				pixel = plane.shift == 16 ? (0xff000000u | value) : (pixel & ~(0xffu << plane.shift)) | value;
+			}
+		}
+	};
+
+	for (std::size_t p = 0; p < planeCount; p += 2)
+	{
+		bool pair = p + 1 < planeCount;
+		load(planes[p], false);
+		if (pair)
+			load(planes[p + 1], true);
+		fft.forward(block);
+		for (std::size_t i = 0; i < area; i++)
+			block[i] = Complex(block[i].real() * spectrum[i].real() - block[i].imag() * spectrum[i].imag(),
+				block[i].real() * spectrum[i].imag() + block[i].imag() * spectrum[i].real());
+		fft.inverse(block);
+		store(planes[p], false);
+		if (pair)
+			store(planes[p + 1], true);
+	}
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include "border.h"
+#include "fft.h"
+#include <map>
+#include <mutex>
+#include <utility>
+
+// Arithmetic of the direct convolution kernels.
+// Float matches the scalar MatrixFilter loop bit for bit: the same taps are
+// summed in the same order, without FMA contraction.
+// Fixed16 quantises the weights to int16 with a common power-of-two scale 2^s
+// and sums in int32. Per channel it differs from Float by at most
+// 255 * sum|w - q / 2^s| + 1 levels. The +1 comes from truncating to an integer.
+// fixedPointErrorBound returns that bound for a given kernel. It stays below
+// 1.1 for the 3x3 kernels in filter.h.
+enum class ConvolutionPrecision
+{
+	Float,
+	Fixed16
+};
+
+// Two-pass convolution with a rank-1 kernel, output rows [begin, end).
+// Each source row is filtered horizontally into a ring of 2 * radius + 1 float
+// rows, and the vertical pass combines the ring. Every convolution below
+// extends the source past its edges by border, clamping by default.
+void convolveSeparable(const PixelView& src, const PixelSpan& dst, int begin, int end,
+	const float* horizontal, const float* vertical, int radius, const Border& border = Border());
+
+// Direct (2r+1)^2 convolution of output rows [begin, end) over interleaved
+// RGBA8. Source rows are padded by radius pixels once per band, so the row
+// kernels read every tap without clamping. The kernels skip zero taps and
+// are picked at run time for the CPU (see simd.h).
+void convolveDirect(const PixelView& src, const PixelSpan& dst, int begin, int end,
+	const float* kernel, int radius, ConvolutionPrecision precision = ConvolutionPrecision::Float,
+	const Border& border = Border());
+
+float fixedPointErrorBound(const float* kernel, int radius);
+
+// Convolution of output rows [begin, end) through the FFT (see fft.h), for
+// large dense kernels. The band is cut into overlap-save tiles: each tile
+// reads radius pixels of context on every side, extended by border as in the
+// direct loop, and keeps only the outputs the circular wrap cannot reach. Two
+// channel planes share one complex transform. The transforms run in double,
+// so the result is the exact sum to about 1e-9 and is then rounded to float
+// and truncated. It therefore differs from the Float direct path by at most
+// one level, and only where that path's float accumulation error (a few
+// float ulps) lands on the other side of an integer. The cost per pixel does
+// not depend on the kernel.
+//
+// A kernel's spectrum depends on the tile size only, so FftKernel computes it
+// once per tile size and keeps it for every band and image; the overload
+// taking coefficients makes a new one per call.
+class FftKernel
+{
+	std::vector<float> taps;
+	int r;
+	mutable std::mutex lock;
+	mutable std::map<std::pair<int, int>, std::vector<Complex>> spectra;
+public:
+	FftKernel(const float* kernel, int radius);
+	int radius() const
+	{
+		return r;
+	}
+	// Spectrum for tileW x tileH tiles in the layout Fft2D::forward leaves,
+	// scaled for the unnormalised inverse. Valid as long as the FftKernel.
+	const Complex* spectrum(int tileW, int tileH) const;
+};
+
+void convolveFFT(const PixelView& src, const PixelSpan& dst, int begin, int end, const FftKernel& kernel,
+	const Border& border = Border());
+void convolveFFT(const PixelView& src, const PixelSpan& dst, int begin, int end, const float* kernel, int radius,
+	const Border& border = Border());
+
+// Non-zero taps from which convolveFFT beats the AVX2 direct kernels, about
+// a dense 27 x 27 kernel on bands of 80 rows or more.
+const int FftMinTaps = 729;
+// Whether a kernel has FftMinTaps or more non-zero taps.
+bool prefersFFT(const float* kernel, int radius);
+
+// Box blur of output rows [begin, end), repeated passes times. Every pass is
+// a horizontal and a vertical sliding-window sum, so a pixel costs the same
+// for any radius. A band reads radius * passes rows of context on each side
+// and every pass extends its input by border, as a chain of single passes would.
+void boxBlur(const PixelView& src, const PixelSpan& dst, int begin, int end, int radius, int passes = 1,
+	const Border& border = Border());
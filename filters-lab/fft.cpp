@@ -0,0 +1,117 @@
+#include "fft.h"
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace
+{
+	// std::complex multiplication checks for infinities and NaNs on every call.
+	inline Complex multiply(const Complex& a, const Complex& b)
+	{
+		return Complex(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+	}
+
+	inline Complex conjugateMultiply(const Complex& a, const Complex& b)
+	{
+		return Complex(a.real() * b.real() + a.imag() * b.imag(), a.imag() * b.real() - a.real() * b.imag());
+	}
+
+	// out (width x height) = in (height x width) transposed, in 16 x 16 blocks.
+	void transpose(const Complex* in, Complex* out, int width, int height)
+	{
+		const int block = 16;
+		for (int y0 = 0; y0 < height; y0 += block)
+			for (int x0 = 0; x0 < width; x0 += block)
+				for (int y = y0; y < std::min(y0 + block, height); y++)
+					for (int x = x0; x < std::min(x0 + block, width); x++)
+						out[std::size_t(x) * height + y] = in[std::size_t(y) * width + x];
+	}
+}
+
+Fft::Fft(int n) : n(n), reversed(n), twiddles(n / 2)
+{
+	int bits = 0;
+	while ((1 << bits) < n)
+		bits++;
+	for (int i = 0; i < n; i++)
+	{
+		int r = 0;
+		for (int b = 0; b < bits; b++)
+			if (i & (1 << b))
+				r |= 1 << (bits - 1 - b);
+		reversed[i] = r;
+	}
+	const double PI = 3.14159265358979323846;
+	for (int k = 0; k < n / 2; k++)
+		twiddles[k] = Complex(std::cos(2 * PI * k / n), -std::sin(2 * PI * k / n));
+}
+
+const Fft& Fft::of(int n)
+{
+	static std::mutex lock;
+	static std::map<int, std::unique_ptr<const Fft>> transforms;
+	std::lock_guard<std::mutex> guard(lock);
+	std::unique_ptr<const Fft>& transform = transforms[n];
+	if (!transform)
+		transform = std::make_unique<const Fft>(n);
+	return *transform;
+}
+
+int Fft::sizeFor(int n)
+{
+	int size = 1;
+	while (size < n)
+		size <<= 1;
+	return size;
+}
+
+void Fft::transform(Complex* data, bool inverse) const
+{
+	for (int i = 0; i < n; i++)
+		if (i < reversed[i])
+			std::swap(data[i], data[reversed[i]]);
+
+	for (int length = 2; length <= n; length <<= 1)
+	{
+		int half = length / 2;
+		int step = n / length;
+		for (int start = 0; start < n; start += length)
+		{
+			Complex* a = data + start;
+			Complex* b = a + half;
+			for (int k = 0; k < half; k++)
+			{
+				const Complex& w = twiddles[k * step];
+				Complex t = inverse ? conjugateMultiply(b[k], w) : multiply(b[k], w);
+				b[k] = a[k] - t;
+				a[k] += t;
+			}
+		}
+	}
+}
+
+void Fft2D::forward(Complex* data)
+{
+	int w = width(), h = height();
+	for (int y = 0; y < h; y++)
+		rows.forward(data + std::size_t(y) * w);
+	Complex* transposed = scratch.as<Complex>();
+	transpose(data, transposed, w, h);
+	for (int x = 0; x < w; x++)
+		columns.forward(transposed + std::size_t(x) * h);
+	std::copy(transposed, transposed + std::size_t(w) * h, data);
+}
+
+void Fft2D::inverse(Complex* data)
+{
+	int w = width(), h = height();
+	for (int x = 0; x < w; x++)
+		columns.inverse(data + std::size_t(x) * h);
+	Complex* transposed = scratch.as<Complex>();
+	transpose(data, transposed, h, w);
+	for (int y = 0; y < h; y++)
+		rows.inverse(transposed + std::size_t(y) * w);
+	std::copy(transposed, transposed + std::size_t(w) * h, data);
+}
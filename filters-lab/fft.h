@@ -0,0 +1,60 @@
+#pragma once
+#include "imagepool.h"
+#include <complex>
+#include <vector>
+
+typedef std::complex<double> Complex;
+
+// Iterative radix-2 FFT of one power-of-two length. Twiddles and the
+// bit-reversal order are computed once; transforms are in place and inverse()
+// does not divide by the length.
+class Fft
+{
+	int n;
+	std::vector<int> reversed;
+	std::vector<Complex> twiddles;
+	void transform(Complex* data, bool inverse) const;
+public:
+	explicit Fft(int n);
+	int size() const
+	{
+		return n;
+	}
+	void forward(Complex* data) const
+	{
+		transform(data, false);
+	}
+	void inverse(Complex* data) const
+	{
+		transform(data, true);
+	}
+	// Smallest power of two >= n.
+	static int sizeFor(int n);
+	// Shared transform of length n, made on first use and kept for the
+	// process, so that the bands of every call reuse its tables.
+	static const Fft& of(int n);
+};
+
+// width x height transform of a row-major block, width and height powers of
+// two. forward() leaves the spectrum transposed (height-long rows, one per
+// column frequency) and inverse() takes it in that layout, so a convolution
+// multiplies spectra without transposing back in between.
+class Fft2D
+{
+	const Fft& rows;
+	const Fft& columns;
+	ImagePool::Buffer scratch;
+public:
+	Fft2D(int width, int height) :
+		rows(Fft::of(width)), columns(Fft::of(height)), scratch(ImagePool::shared().buffer(sizeof(Complex) * width * height)) {}
+	int width() const
+	{
+		return rows.size();
+	}
+	int height() const
+	{
+		return columns.size();
+	}
+	void forward(Complex* data);
+	void inverse(Complex* data);
+};
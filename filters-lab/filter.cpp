@@ -1,4 +1,5 @@
 #include "filter.h"
+#include "imagestats.h"
 
 template <class T>
 T clamp(T value, T max, T min)
@@ -10,17 +11,56 @@ T clamp(T value, T max, T min)
 	return value;
 }
 
-double RDouble(int low, int high) {
-	double res;
-	return res = double(rand()) / RAND_MAX * (high - low) + low;
+int bandHeight(int height, int halo)
+{
+	int threads = int(ThreadPool::shared().threadCount());
+	int band = (height + threads * 4 - 1) / (threads * 4);
+	// Keep the recomputed halo small next to the band, but leave every thread a band.
+	int perThread = (height + threads - 1) / threads;
+	return std::max(1, std::max(band, std::min(4 * halo, perThread)));
 }
 
-QImage Filter::process(const QImage& img) const
+void forEachBand(int height, const std::function<void(int, int)>& body, int halo)
+{
+#if defined(CGLAB_TRACE)
+	// Bands are named after the scope that hands them out.
+	const char* owner = Trace::current();
+	if (owner)
+	{
+		ThreadPool::shared().parallelFor(0, height, bandHeight(height, halo), [&](int begin, int end)
+		{
+			TraceScope band(owner, "band");
+			band.rows = end - begin;
+			body(begin, end);
+		});
+		return;
+	}
+#endif
+	ThreadPool::shared().parallelFor(0, height, bandHeight(height, halo), body);
+}
+
+QRgb Filter::calcNewPixel(const PixelView& img, int x, int y) const
+{
+	return calcNewPixelColor(img.source(), x, y).rgba();
+}
+
+void Filter::processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const
+{
+	for (int y = begin; y < end; y++)
+	{
+		QRgb* out = dst.row(y);
+		for (int x = 0; x < src.width(); x++)
+			out[x] = calcNewPixel(src, x, y);
+	}
+}
+
+QImage Filter::processColors(const QImage& img) const
 {
 	QImage result(img);
+	CGLAB_TRACE_ALLOCATED(img.sizeInBytes());
 
-	for (int x = 0; x < img.width(); x++)
-		for (int y = 0; y < img.height(); y++)
+	for (int y = 0; y < img.height(); y++)
+		for (int x = 0; x < img.width(); x++)
 		{
 			QColor color = calcNewPixelColor(img, x, y);
 			result.setPixelColor(x, y, color);
@@ -29,6 +69,147 @@ QImage Filter::process(const QImage& img) const
 	return result;
 }
 
+QImage Filter::process(const QImage& img) const
+{
+	CGLAB_TRACE_PROCESS(img);
+	if (!PixelView::isSupported(img.format()))
+		return processColors(img);
+
+	QImage result = ImagePool::shared().image(img.size(), img.format());
+	PixelView src(img);
+	PixelSpan dst(result);
+	forEachBand(img.height(), [&](int begin, int end)
+	{
+		processRows(src, dst, begin, end);
+	}, halo());
+
+	return result;
+}
+
+void Filter::processArea(const QImage& img, const QRect& area, QImage& target, const QPoint& at) const
+{
+	CGLAB_TRACE_PROCESS(area);
+	// The rows are copied as QRgb words, so both images must be one of the
+	// 32-bit formats PixelView reads, and the same one.
+	if (!PixelView::isSupported(img.format()) || target.format() != img.format())
+		throw std::invalid_argument("processArea needs a 32-bit source and a target of the same format");
+	if (!img.rect().contains(area) || !target.rect().contains(QRect(at, area.size())))
+		throw std::invalid_argument("processArea outside the source or target");
+	int w = img.width(), h = img.height(), halo = this->halo();
+	int top = std::max(0, area.top() - halo), bottom = std::min(h, area.bottom() + 1 + halo);
+	int left = 0, right = w;
+	if (!dependsOnPosition())
+	{
+		left = std::max(0, area.left() - halo);
+		right = std::min(w, area.right() + 1 + halo);
+	}
+
+	// Source columns [left, right) of rows [top, bottom), addressed in image rows.
+	// Columns cut at the halo only shift the output, so the filter may see them
+	// as the image edges: the area is at least halo() away from such a cut.
+	QImage window = img;
+	int windowTop = 0;
+	if (left > 0 || right < w)
+	{
+		window = ImagePool::shared().image(right - left, bottom - top, img.format());
+		for (int y = top; y < bottom; y++)
+			std::memcpy(window.scanLine(y - top), img.constScanLine(y) + left * sizeof(QRgb), (right - left) * sizeof(QRgb));
+		windowTop = top;
+	}
+	QImage rows = ImagePool::shared().image(right - left, area.height(), img.format());
+	PixelView src(window, windowTop, h);
+	PixelSpan dst(rows, area.top(), h);
+	ThreadPool::shared().parallelFor(area.top(), area.bottom() + 1, bandHeight(area.height(), halo), [&](int begin, int end)
+	{
+		processRows(src, dst, begin, end);
+	});
+
+	uchar* bits = target.bits();
+	qsizetype stride = target.bytesPerLine();
+	for (int y = 0; y < area.height(); y++)
+		std::memcpy(bits + (at.y() + y) * stride + at.x() * sizeof(QRgb), rows.constScanLine(y) + (area.left() - left) * sizeof(QRgb), area.width() * sizeof(QRgb));
+}
+
+QImage Filter::processRegion(const QImage& img, const QRect& roi) const
+{
+	QRect area = roi & img.rect();
+	if (area.isEmpty())
+		return QImage();
+	if (!isLocal() || !PixelView::isSupported(img.format()))
+		return process(img).copy(area);
+
+	QImage result = ImagePool::shared().image(area.size(), img.format());
+	processArea(img, area, result, QPoint(0, 0));
+	return result;
+}
+
+void Filter::update(const QImage& img, QImage& output, const std::vector<QRect>& dirty) const
+{
+	if (output.size() != img.size() || output.format() != img.format() || !isLocal() || !PixelView::isSupported(img.format()))
+	{
+		output = process(img);
+		return;
+	}
+
+	int halo = this->halo();
+	std::vector<QRect> areas;
+	for (QRect rect : dirty)
+	{
+		if (dependsOnPosition())
+			rect = QRect(0, rect.top() - halo, img.width(), rect.height() + 2 * halo);
+		else
+			rect.adjust(-halo, -halo, halo, halo);
+		rect &= img.rect();
+		if (rect.isEmpty())
+			continue;
+		// Overlapping areas are merged into their bounding rectangle, so that
+		// no pixel is computed twice over.
+		for (std::size_t i = 0; i < areas.size();)
+			if (areas[i].intersects(rect))
+			{
+				rect |= areas[i];
+				areas.erase(areas.begin() + i);
+				i = 0;
+			}
+			else
+				i++;
+		areas.push_back(rect);
+	}
+	for (const QRect& area : areas)
+		processArea(img, area, output, area.topLeft());
+}
+
+void Kernel::factorize()
+{
+	int size = getSize();
+	separable = false;
+	horizontal.assign(size, 0.f);
+	vertical.assign(size, 0.f);
+
+	// Pivot on the largest coefficient: its row and column are the factors
+	// if the kernel has rank 1.
+	std::size_t pivot = 0;
+	for (std::size_t i = 1; i < getLen(); i++)
+		if (std::fabs(data[i]) > std::fabs(data[pivot]))
+			pivot = i;
+	float peak = data[pivot];
+	if (peak == 0.f)
+		return;
+	int pi = pivot / size, pj = pivot % size;
+	for (int i = 0; i < size; i++)
+	{
+		vertical[i] = data[i * size + pj];
+		horizontal[i] = data[pi * size + i] / peak;
+	}
+
+	float tolerance = 1e-5f * std::fabs(peak);
+	for (int i = 0; i < size; i++)
+		for (int j = 0; j < size; j++)
+			if (std::fabs(data[i * size + j] - vertical[i] * horizontal[j]) > tolerance)
+				return;
+	separable = true;
+}
+
 QColor MatrixFilter::calcNewPixelColor(const QImage& img, int x, int y) const
 {
 	float returnR = 0;
@@ -42,7 +223,7 @@ QColor MatrixFilter::calcNewPixelColor(const QImage& img, int x, int y) const
 		{
 			int idx = (i + radius) * size + j + radius;
 
-			QColor color = img.pixelColor(clamp(x + j, img.width() - 1, 0), clamp(y + i, img.height() - 1, 0));
+			QColor color = border.pixelColor(img, x + j, y + i);
 			returnR += color.red() * mKernel[idx];
 			returnG += color.green() * mKernel[idx];
 			returnB += color.blue() * mKernel[idx];
@@ -51,6 +232,148 @@ QColor MatrixFilter::calcNewPixelColor(const QImage& img, int x, int y) const
 	return QColor(clamp(returnR, 255.f, 0.f), clamp(returnG, 255.f, 0.f), clamp(returnB, 255.f, 0.f));
 }
 
+QRgb MatrixFilter::calcNewPixel(const PixelView& img, int x, int y) const
+{
+	float returnR = 0;
+	float returnG = 0;
+	float returnB = 0;
+
+	int size = mKernel.getSize();
+	int radius = mKernel.getRadius();
+	for (int i = -radius; i <= radius; i++)
+	{
+		for (int j = -radius; j <= radius; j++)
+		{
+			int idx = (i + radius) * size + j + radius;
+
+			QRgb color = border.pixel(img, x + j, y + i);
+			returnR += qRed(color) * mKernel[idx];
+			returnG += qGreen(color) * mKernel[idx];
+			returnB += qBlue(color) * mKernel[idx];
+		}
+	}
+
+	return qRgb(clamp(returnR, 255.f, 0.f), clamp(returnG, 255.f, 0.f), clamp(returnB, 255.f, 0.f));
+}
+
+void MatrixFilter::processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const
+{
+	if (!convolves)
+		Filter::processRows(src, dst, begin, end);
+	else if (mKernel.isSeparable() && mKernel.getRadius() > 1)
+		convolveSeparable(src, dst, begin, end, mKernel.horizontalFactor(), mKernel.verticalFactor(), mKernel.getRadius(), border);
+	else if (usesFFT())
+		convolveFFT(src, dst, begin, end, *fftKernel, border);
+	else
+		convolveDirect(src, dst, begin, end, mKernel.coefficients(), mKernel.getRadius(), precision, border);
+}
+
+QImage MatrixFilter::process(const QImage& img) const
+{
+	// Kernels large enough for the FFT are out of reach of the QColor loop.
+	if (usesFFT() && !PixelView::isSupported(img.format()))
+		return Filter::process(img.convertToFormat(QImage::Format_ARGB32)).convertToFormat(img.format());
+	return Filter::process(img);
+}
+
+void BlurFilter::processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const
+{
+	boxBlur(src, dst, begin, end, mKernel.getRadius(), passes, border);
+}
+
+QImage BlurFilter::process(const QImage& img) const
+{
+	// The QColor fallback only knows a single pass.
+	if (passes > 1 && !PixelView::isSupported(img.format()))
+		return MatrixFilter::process(img.convertToFormat(QImage::Format_ARGB32)).convertToFormat(img.format());
+	return MatrixFilter::process(img);
+}
+
+// Histograms of lut applied to src, merged band by band in row order.
+static ChannelHistograms mappedHistograms(const PixelView& src, const PointLut& lut)
+{
+	int band = bandHeight(src.height());
+	std::vector<ChannelHistograms> bands((src.height() + band - 1) / band);
+	forEachBand(src.height(), [&](int begin, int end)
+	{
+		lut.count(src, begin, end, bands[begin / band]);
+	});
+	ChannelHistograms total;
+	for (const ChannelHistograms& part : bands)
+		total.add(part);
+	return total;
+}
+
+static QImage applyLut(const QImage& img, const PointLut& lut)
+{
+	QImage result = ImagePool::shared().image(img.size(), img.format());
+	PixelView src(img);
+	PixelSpan dst(result);
+	forEachBand(img.height(), [&](int begin, int end)
+	{
+		lut.apply(src, dst, begin, end);
+	});
+	return result;
+}
+
+// Luminance-mix table of the GrayScale and Sepia weights.
+static PointLut luminanceLut(const std::function<QRgb(double)>& map)
+{
+	static const double weights[3] = {0.299, 0.587, 0.114};
+	return PointLut::luminance(weights, map);
+}
+
+PointLut PointFilter::compile(const ChannelHistograms& input) const
+{
+	QImage ramp(256, 1, QImage::Format_RGB32);
+	PixelSpan values(ramp);
+	for (int v = 0; v < 256; v++)
+		values.row(0)[v] = qRgb(v, v, v);
+
+	PixelView view(ramp);
+	PointLut lut;
+	for (int v = 0; v < 256; v++)
+	{
+		QRgb color = calcNewPixel(view, v, 0);
+		lut.channel[0][v] = qRed(color);
+		lut.channel[1][v] = qGreen(color);
+		lut.channel[2][v] = qBlue(color);
+	}
+	return lut;
+}
+
+QImage PointFilter::process(const QImage& img) const
+{
+	CGLAB_TRACE_PROCESS(img);
+	if (!PixelView::isSupported(img.format()))
+		return process(img.convertToFormat(QImage::Format_ARGB32)).convertToFormat(img.format());
+
+	if (!needsHistograms())
+		return applyLut(img, compile(ChannelHistograms()));
+	return applyLut(img, compile(imageStats(img)->histograms));
+}
+
+QImage PointChain::process(const QImage& img) const
+{
+	CGLAB_TRACE_PROCESS(img);
+	if (!PixelView::isSupported(img.format()))
+		return process(img.convertToFormat(QImage::Format_ARGB32)).convertToFormat(img.format());
+
+	// Statistics a stage needs are those of its input, i.e. of the source
+	// mapped through the stages fused so far. The first stage shares the
+	// cached statistics of the source.
+	PixelView src(img);
+	PointLut fused;
+	for (const PointFilter* stage : stages)
+	{
+		ChannelHistograms input;
+		if (stage->needsHistograms())
+			input = stage == stages.front() ? imageStats(img)->histograms : mappedHistograms(src, fused);
+		fused = fused.then(stage->compile(input));
+	}
+	return applyLut(img, fused);
+}
+
 QColor InvertFilter::calcNewPixelColor(const QImage& img, int x, int y) const
 {
 	QColor color = img.pixelColor(x, y);
@@ -58,6 +381,12 @@ QColor InvertFilter::calcNewPixelColor(const QImage& img, int x, int y) const
 	return color;
 }
 
+QRgb InvertFilter::calcNewPixel(const PixelView& img, int x, int y) const
+{
+	QRgb color = img.at(x, y);
+	return qRgb(255 - qRed(color), 255 - qGreen(color), 255 - qBlue(color));
+}
+
 QColor GrayScaleFilter::calcNewPixelColor(const QImage& img, int x, int y) const
 {
 	QColor color = img.pixelColor(x, y);
@@ -66,6 +395,22 @@ QColor GrayScaleFilter::calcNewPixelColor(const QImage& img, int x, int y) const
 	return color;
 }
 
+QRgb GrayScaleFilter::fromIntensity(double Intensity) const
+{
+	return qRgb(Intensity, Intensity, Intensity);
+}
+
+QRgb GrayScaleFilter::calcNewPixel(const PixelView& img, int x, int y) const
+{
+	QRgb color = img.at(x, y);
+	return fromIntensity(0.299 * qRed(color) + 0.587 * qGreen(color) + 0.114 * qBlue(color));
+}
+
+PointLut GrayScaleFilter::compile(const ChannelHistograms& input) const
+{
+	return luminanceLut([this](double Intensity) { return fromIntensity(Intensity); });
+}
+
 QColor Sepia::calcNewPixelColor(const QImage& img, int x, int y) const
 {
 	QColor color = img.pixelColor(x, y);
@@ -74,6 +419,22 @@ QColor Sepia::calcNewPixelColor(const QImage& img, int x, int y) const
 	return color;
 }
 
+QRgb Sepia::fromIntensity(double Intensity) const
+{
+	return qRgb(clamp(Intensity + 2 * k, 255.0, 0.0), clamp(Intensity + 0.5 * k, 255.0, 0.0), clamp(Intensity - k, 255.0, 0.0));
+}
+
+QRgb Sepia::calcNewPixel(const PixelView& img, int x, int y) const
+{
+	QRgb color = img.at(x, y);
+	return fromIntensity(0.299 * qRed(color) + 0.587 * qGreen(color) + 0.114 * qBlue(color));
+}
+
+PointLut Sepia::compile(const ChannelHistograms& input) const
+{
+	return luminanceLut([this](double Intensity) { return fromIntensity(Intensity); });
+}
+
 QColor Brightness::calcNewPixelColor(const QImage& img, int x, int y) const
 {
 	QColor color = img.pixelColor(x, y);
@@ -81,6 +442,12 @@ QColor Brightness::calcNewPixelColor(const QImage& img, int x, int y) const
 	return color;
 }
 
+QRgb Brightness::calcNewPixel(const PixelView& img, int x, int y) const
+{
+	QRgb color = img.at(x, y);
+	return qRgb(clamp(qRed(color) + C, 255, 0), clamp(qGreen(color) + C, 255, 0), clamp(qBlue(color) + C, 255, 0));
+}
+
 QColor GreyWorld::calcNewPixelColor(const QImage& img, int x, int y) const
 {
 	QColor color = img.pixelColor(x, y);
@@ -88,24 +455,33 @@ QColor GreyWorld::calcNewPixelColor(const QImage& img, int x, int y) const
 	return color;
 }
 
-QImage GreyWorld::process(const QImage& img)
+QRgb GreyWorld::calcNewPixel(const PixelView& img, int x, int y) const
 {
-	for (int x = 0; x < img.width(); x++)
-		for (int y = 0; y < img.height(); y++)
-		{
-			QColor tmp = img.pixelColor(x, y);
-			Rs += tmp.red();
-			Gs += tmp.green();
-			Bs += tmp.blue();
-		}
-
-	Rs /= img.width() * img.height();
-	Gs /= img.width() * img.height();
-	Bs /= img.width() * img.height();
+	QRgb color = img.at(x, y);
+	return qRgb(clamp((AVG * qRed(color) / Rs), 255.0, 0.0), clamp((AVG * qGreen(color) / Gs), 255.0, 0.0), clamp((AVG * qBlue(color) / Bs), 255.0, 0.0));
+}
 
-	AVG = (Rs + Gs + Bs) / 3;
+PointLut GreyWorld::compile(const ChannelHistograms& input) const
+{
+	// The averages live in a copy, so compile() stays const and reentrant.
+	GreyWorld balanced;
+	balanced.Rs = double(input.sum(0)) / input.pixels;
+	balanced.Gs = double(input.sum(1)) / input.pixels;
+	balanced.Bs = double(input.sum(2)) / input.pixels;
+	balanced.AVG = (balanced.Rs + balanced.Gs + balanced.Bs) / 3;
+
+	return balanced.PointFilter::compile(input);
+}
 
-	return Filter::process(img);
+LinealStretching::LinealStretching(const QImage& img)
+{
+	std::shared_ptr<const ImageStats> stats = imageStats(img);
+	minR = stats->min[0];
+	minG = stats->min[1];
+	minB = stats->min[2];
+	maxR = stats->max[0];
+	maxG = stats->max[1];
+	maxB = stats->max[2];
 }
 
 QColor LinealStretching::calcNewPixelColor(const QImage& img, int x, int y) const
@@ -115,41 +491,100 @@ QColor LinealStretching::calcNewPixelColor(const QImage& img, int x, int y) cons
 	return color;
 }
 
+QRgb LinealStretching::calcNewPixel(const PixelView& img, int x, int y) const
+{
+	QRgb color = img.at(x, y);
+	return qRgb(clamp(((qRed(color) - minR) * 255 / (maxR - minR)), 255.f, 0.f), clamp(((qGreen(color) - minG) * 255 / (maxG - minG)), 255.f, 0.f), clamp(((qBlue(color) - minB) * 255 / (maxB - minB)), 255.f, 0.f));
+}
+
+void RemapFilter::processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const
+{
+	std::string key = remapKey() + (sampling == Sampling::Bilinear ? "/bilinear" : "/nearest");
+	cachedRemap(key, src.width(), src.height(), [&]
+	{
+		return buildRemap(src.width(), src.height());
+	})->apply(src, dst, begin, end);
+}
+
 QColor HorizontalWaves::calcNewPixelColor(const QImage& img, int x, int y) const
 {
 	int X = x + 20 * sin((2 * PI * y) / 60);
 	int Y = y;
 	QColor color = img.pixelColor(x, y);
-	color.setRgb(img.pixelColor(clamp(X, 0, img.width() - 1), Y).red(), img.pixelColor(clamp(X, 0, img.width() - 1), Y).green(), img.pixelColor(clamp(X, 0, img.width() - 1), Y).blue());
+	color.setRgb(img.pixelColor(clamp(X, img.width() - 1, 0), Y).red(), img.pixelColor(clamp(X, img.width() - 1, 0), Y).green(), img.pixelColor(clamp(X, img.width() - 1, 0), Y).blue());
 	return color;
 }
 
+std::string HorizontalWaves::remapKey() const
+{
+	return "HorizontalWaves";
+}
+
+RemapTable HorizontalWaves::buildRemap(int width, int height) const
+{
+	return RemapTable::rows(width, height, 0, [](int y) { return 20 * sin((2 * PI * y) / 60); }, sampling, RemapBorder::Clamp);
+}
+
 QColor VerticalWaves::calcNewPixelColor(const QImage& img, int x, int y) const
 {
 	int X = x + 20 * sin((2 * PI * x) / 30);
 	int Y = y;
 	QColor color = img.pixelColor(x, y);
-	color.setRgb(img.pixelColor(clamp(X, 0, img.width() - 1), Y).red(), img.pixelColor(clamp(X, 0, img.width() - 1), Y).green(), img.pixelColor(clamp(X, 0, img.width() - 1), Y).blue());
+	color.setRgb(img.pixelColor(clamp(X, img.width() - 1, 0), Y).red(), img.pixelColor(clamp(X, img.width() - 1, 0), Y).green(), img.pixelColor(clamp(X, img.width() - 1, 0), Y).blue());
 	return color;
 }
 
+std::string VerticalWaves::remapKey() const
+{
+	return "VerticalWaves";
+}
+
+RemapTable VerticalWaves::buildRemap(int width, int height) const
+{
+	return RemapTable::columns(width, height, [](int x) { return x + 20 * sin((2 * PI * x) / 30); }, sampling, RemapBorder::Clamp);
+}
+
 QColor Glass::calcNewPixelColor(const QImage& img, int x, int y) const
 {
-	QColor color;
-	color = img.pixelColor(clamp(x + (RDouble(0, 1) - 0.5) * 10, double(img.width() - 1), 0.0), clamp(y + (RDouble(0, 1) - 0.5) * 10, double(img.height() - 1), 0.0));
-	return color;
+	double sx, sy;
+	source(x, y, sx, sy);
+	return img.pixelColor(clamp(sx, double(img.width() - 1), 0.0), clamp(sy, double(img.height() - 1), 0.0));
+}
+
+std::string Glass::remapKey() const
+{
+	return "Glass " + std::to_string(seed) + " " + std::to_string(reach);
+}
+
+RemapTable Glass::buildRemap(int width, int height) const
+{
+	return RemapTable::pixels(width, height, [this](int x, int y, double& sx, double& sy)
+	{
+		source(x, y, sx, sy);
+	}, sampling, RemapBorder::Clamp);
 }
 
 QColor Transfer::calcNewPixelColor(const QImage& img, int x, int y) const
 {
 	QColor color;
-	if (x + x1 < img.width() && y + y1 < img.height())
+	if (x + x1 >= 0 && x + x1 < img.width() && y + y1 >= 0 && y + y1 < img.height())
 		color = img.pixelColor(x + x1, y + y1);
 	else
 		color.setRgb(0, 0, 0);
 	return color;
 }
 
+std::string Transfer::remapKey() const
+{
+	return "Transfer " + std::to_string(x1) + " " + std::to_string(y1);
+}
+
+RemapTable Transfer::buildRemap(int width, int height) const
+{
+	int dx = x1;
+	return RemapTable::rows(width, height, y1, [dx](int) { return double(dx); }, sampling, RemapBorder::Black);
+}
+
 QColor Dilation::calcNewPixelColor(const QImage& img, int x, int y) const
 {
 	float returnR = 0, tmpR = 0;
@@ -161,7 +596,7 @@ QColor Dilation::calcNewPixelColor(const QImage& img, int x, int y) const
 		for (int j = -radius; j <= radius; j++)
 		{
 			int idx = (i + radius) * size + j + radius;
-			QColor color = img.pixelColor(clamp(x + j, img.width() - 1, 0), clamp(y + i, img.height() - 1, 0));
+			QColor color = border.pixelColor(img, x + j, y + i);
 			tmpR = color.red() * mKernel[idx];
 			tmpG = color.green() * mKernel[idx];
 			tmpB = color.blue() * mKernel[idx];
@@ -175,6 +610,41 @@ QColor Dilation::calcNewPixelColor(const QImage& img, int x, int y) const
 	return QColor(clamp(returnR, 255.f, 0.f), clamp(returnG, 255.f, 0.f), clamp(returnB, 255.f, 0.f));
 }
 
+QRgb Dilation::calcNewPixel(const PixelView& img, int x, int y) const
+{
+	float returnR = 0, tmpR = 0;
+	float returnG = 0, tmpG = 0;
+	float returnB = 0, tmpB = 0;
+	int size = mKernel.getSize();
+	int radius = mKernel.getRadius();
+	for (int i = -radius; i <= radius; i++)
+	{
+		for (int j = -radius; j <= radius; j++)
+		{
+			int idx = (i + radius) * size + j + radius;
+			QRgb color = border.pixel(img, x + j, y + i);
+			tmpR = qRed(color) * mKernel[idx];
+			tmpG = qGreen(color) * mKernel[idx];
+			tmpB = qBlue(color) * mKernel[idx];
+			if (tmpR > returnR)
+				returnR = tmpR;
+			if (tmpG > returnG)
+				returnG = tmpG;
+			if (tmpB > returnB)
+				returnB = tmpB;
+		}
+	}
+	return qRgb(clamp(returnR, 255.f, 0.f), clamp(returnG, 255.f, 0.f), clamp(returnB, 255.f, 0.f));
+}
+
+void Dilation::processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const
+{
+	if (!rects.empty())
+		morphology(src, dst, begin, end, rects, MorphOp::Dilate, border);
+	else
+		weightedMorphology(src, dst, begin, end, mKernel.coefficients(), mKernel.getRadius(), MorphOp::Dilate, border);
+}
+
 QColor Erosion::calcNewPixelColor(const QImage& img, int x, int y) const
 {
 	float returnR = 255, tmpR = 0;
@@ -186,7 +656,9 @@ QColor Erosion::calcNewPixelColor(const QImage& img, int x, int y) const
 		for (int j = -radius; j <= radius; j++)
 		{
 			int idx = (i + radius) * size + j + radius;
-			QColor color = img.pixelColor(clamp(x + j, img.width() - 1, 0), clamp(y + i, img.height() - 1, 0));
+			if (flat && mKernel[idx] == 0.f)
+				continue;
+			QColor color = border.pixelColor(img, x + j, y + i);
 			tmpR = color.red() * mKernel[idx];
 			tmpG = color.green() * mKernel[idx];
 			tmpB = color.blue() * mKernel[idx];
@@ -200,19 +672,67 @@ QColor Erosion::calcNewPixelColor(const QImage& img, int x, int y) const
 	return QColor(clamp(returnR, 255.f, 0.f), clamp(returnG, 255.f, 0.f), clamp(returnB, 255.f, 0.f));
 }
 
+QRgb Erosion::calcNewPixel(const PixelView& img, int x, int y) const
+{
+	float returnR = 255, tmpR = 0;
+	float returnG = 255, tmpG = 0;
+	float returnB = 255, tmpB = 0;
+	int size = mKernel.getSize();
+	int radius = mKernel.getRadius();
+	for (int i = -radius; i <= radius; i++)
+	{
+		for (int j = -radius; j <= radius; j++)
+		{
+			int idx = (i + radius) * size + j + radius;
+			if (flat && mKernel[idx] == 0.f)
+				continue;
+			QRgb color = border.pixel(img, x + j, y + i);
+			tmpR = qRed(color) * mKernel[idx];
+			tmpG = qGreen(color) * mKernel[idx];
+			tmpB = qBlue(color) * mKernel[idx];
+			if (tmpR < returnR)
+				returnR = tmpR;
+			if (tmpG < returnG)
+				returnG = tmpG;
+			if (tmpB < returnB)
+				returnB = tmpB;
+		}
+	}
+	return qRgb(clamp(returnR, 255.f, 0.f), clamp(returnG, 255.f, 0.f), clamp(returnB, 255.f, 0.f));
+}
+
+void Erosion::processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const
+{
+	if (!rects.empty())
+		morphology(src, dst, begin, end, rects, MorphOp::Erode, border);
+	else
+		weightedMorphology(src, dst, begin, end, mKernel.coefficients(), mKernel.getRadius(), MorphOp::Erode, border);
+}
+
 QColor Opening::calcNewPixelColor(const QImage& img, int x, int y) const
 {
 	QColor a;
 	return a;
 }
 
+void Opening::processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const
+{
+	morphologyChain(src, dst, begin, end, rects, MorphOp::Dilate, border);
+}
+
 QImage Opening::process(const QImage& img) const
 {
+	CGLAB_TRACE_PROCESS(img);
+	if (PixelView::isSupported(img.format()))
+		return MatrixFilter::process(img);
+
 	QImage result;
 	int rad = mKernel.getRadius();
 	Dilation dil(rad);
+	dil.setBorder(border);
 	result = dil.process(img);
 	Erosion eros(rad);
+	eros.setBorder(border);
 	result = eros.process(result);
 	return result;
 }
@@ -223,34 +743,87 @@ QColor Closing::calcNewPixelColor(const QImage& img, int x, int y) const
 	return a;
 }
 
+void Closing::processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const
+{
+	morphologyChain(src, dst, begin, end, rects, MorphOp::Erode, border);
+}
+
 QImage Closing::process(const QImage& img) const
 {
+	CGLAB_TRACE_PROCESS(img);
+	if (PixelView::isSupported(img.format()))
+		return MatrixFilter::process(img);
+
 	QImage result;
 	int rad = mKernel.getRadius();
 	Erosion eros(rad);
+	eros.setBorder(border);
 	result = eros.process(img);
 	Dilation dil(rad);
+	dil.setBorder(border);
 	result = dil.process(result);
 	return result;
 }
 
+QColor SobelEdges::calcNewPixelColor(const QImage& img, int x, int y) const
+{
+	int luma[3][3];
+	for (int i = -1; i <= 1; i++)
+		for (int j = -1; j <= 1; j++)
+		{
+			QColor color = img.pixelColor(clamp(x + j, img.width() - 1, 0), clamp(y + i, img.height() - 1, 0));
+			luma[i + 1][j + 1] = (77 * color.red() + 150 * color.green() + 29 * color.blue() + 128) >> 8;
+		}
+	int gx = luma[0][2] + 2 * luma[1][2] + luma[2][2] - luma[0][0] - 2 * luma[1][0] - luma[2][0];
+	int gy = luma[2][0] + 2 * luma[2][1] + luma[2][2] - luma[0][0] - 2 * luma[0][1] - luma[0][2];
+	int m = std::min(255, int(std::lround(std::sqrt(double(gx * gx + gy * gy)))));
+	return QColor(m, m, m);
+}
+
+void SobelEdges::processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const
+{
+	SobelOptions options;
+	options.planes = SobelMagnitude;
+	options.norm = GradientNorm::L2;
+	sobelRows(src, begin, end, options, [&](int y, const SobelRow& row)
+	{
+		QRgb* out = dst.row(y);
+		for (int x = 0; x < src.width(); x++)
+		{
+			int m = std::min<int>(255, row.magnitude[x]);
+			out[x] = qRgb(m, m, m);
+		}
+	});
+}
+
 QColor Grad::calcNewPixelColor(const QImage& img, int x, int y) const
 {
 	QColor a;
 	return a;
 }
 
+void Grad::processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const
+{
+	morphologyGradient(src, dst, begin, end, rects, border);
+}
+
 QImage Grad::process(const QImage& img) const
 {
+	CGLAB_TRACE_PROCESS(img);
+	if (PixelView::isSupported(img.format()))
+		return MatrixFilter::process(img);
+
 	QImage tmp1, tmp2, result(img);
 	int rad = mKernel.getRadius();
 	Dilation dil(rad);
+	dil.setBorder(border);
 	tmp1 = dil.process(img);
 	Erosion eros(rad);
+	eros.setBorder(border);
 	tmp2 = eros.process(img);
 
-	for (int x = 0; x < tmp1.width(); x++)
-		for (int y = 0; y < tmp2.height(); y++)
+	for (int y = 0; y < tmp2.height(); y++)
+		for (int x = 0; x < tmp1.width(); x++)
 		{
 			QColor color1 = tmp1.pixelColor(x, y);
 			QColor color2 = tmp2.pixelColor(x, y);
@@ -262,31 +835,39 @@ QImage Grad::process(const QImage& img) const
 	return result;
 }
 
-QColor Median::calcNewPixelColor(const QImage& img, int x, int y) const
+int RankFilter::rank() const
+{
+	int last = mKernel.getSize() * mKernel.getSize() - 1;
+	return clamp(int(percentile * last + 0.5f), last, 0);
+}
+
+QColor RankFilter::calcNewPixelColor(const QImage& img, int x, int y) const
 {
 	int size = mKernel.getSize();
 	int radius = mKernel.getRadius();
-	int* masR, * masG, * masB;
-	masR = new int[size * size];
-	masG = new int[size * size];
-	masB = new int[size * size];
+	std::vector<int> masR(size * size), masG(size * size), masB(size * size);
 
 	for (int i = -radius; i <= radius; i++)
 		for (int j = -radius; j <= radius; j++)
 		{
 			int idx = (i + radius) * size + j + radius;
-			QColor color = img.pixelColor(clamp(x + j, img.width() - 1, 0), clamp(y + i, img.height() - 1, 0));
+			QColor color = border.pixelColor(img, x + j, y + i);
 			masR[idx] = color.red();
 			masG[idx] = color.green();
 			masB[idx] = color.blue();
 		}
 
-	std::sort(masR, masR + size * size);
-	std::sort(masG, masG + size * size);
-	std::sort(masB, masB + size * size);
+	std::sort(masR.begin(), masR.end());
+	std::sort(masG.begin(), masG.end());
+	std::sort(masB.begin(), masB.end());
 
 	QColor col;
-	col.setRgb(clamp(masR[size * size / 2], 255, 0), clamp(masG[size * size / 2], 255, 0), clamp(masB[size * size / 2], 255, 0));
+	col.setRgb(clamp(masR[rank()], 255, 0), clamp(masG[rank()], 255, 0), clamp(masB[rank()], 255, 0));
 
 	return col;
 }
+
+void RankFilter::processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const
+{
+	rankFilter(src, dst, begin, end, mKernel.getRadius(), rank(), border);
+}
@@ -8,16 +8,79 @@
 #include <fstream>
 #include <string>
 #include <cmath>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <stdexcept>
+#include "border.h"
+#include "pixelview.h"
+#include "threadpool.h"
+#include "convolution.h"
+#include "imagepool.h"
+#include "rankfilter.h"
+#include "morphology.h"
+#include "pointop.h"
+#include "random.h"
+#include "remap.h"
+#include "sobel.h"
+#include "statickernel.h"
+#include "trace.h"
 
 const double PI = 3.14159265;
 
+// Rows per band when a pass of the given height is split across the shared pool.
+// Filters that recompute halo rows of context per band get taller bands.
+int bandHeight(int height, int halo = 0);
+// Runs body(begin, end) over row bands of [0, height) on ThreadPool::shared().
+void forEachBand(int height, const std::function<void(int, int)>& body, int halo = 0);
+
 class Filter
 {
+	friend class Pipeline;
+	friend class StripProcessor;
 protected:
+	// Generic QColor path, used only for image formats PixelView does not support.
 	virtual QColor calcNewPixelColor(const QImage& img, int x, int y) const = 0;
+	// Fast path on raw QRgb scanlines. Defaults to the QColor path.
+	virtual QRgb calcNewPixel(const PixelView& img, int x, int y) const;
+	// Computes output rows [begin, end) in row-major order.
+	virtual void processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const;
+	QImage processColors(const QImage& img) const;
+	// Computes the output pixels of area, a local filter on a supported format,
+	// into target at at. Throws std::invalid_argument unless img and target
+	// share a PixelView format and hold area and its copy at at.
+	void processArea(const QImage& img, const QRect& area, QImage& target, const QPoint& at) const;
 public:
 	virtual ~Filter() = default;
 	virtual QImage process(const QImage& img) const;
+	// Output pixels of roi (clipped to the image) as a roi-sized image, computed
+	// from roi grown by halo(). Filters that are not local compute the whole image.
+	// The pixels equal those of process(), except on the FFT path
+	// (MatrixFilter::usesFFT), whose tiles follow the region: there they may
+	// differ by the one level convolveFFT allows against the exact sum.
+	QImage processRegion(const QImage& img, const QRect& roi) const;
+	// Brings output, the result of process() on img before the dirty rects of
+	// img changed, up to date by recomputing the output pixels within halo()
+	// of them, with the same exactness as processRegion. An output of another
+	// size or format is recomputed whole.
+	void update(const QImage& img, QImage& output, const std::vector<QRect>& dirty) const;
+	// Rows (and columns) of source context each output pixel depends on.
+	virtual int halo() const
+	{
+		return 0;
+	}
+	// Whether processRows() computes rows from halo() rows of context alone.
+	// Filters that need whole-image statistics only run through process().
+	virtual bool isLocal() const
+	{
+		return true;
+	}
+	// Whether output pixels depend on their position as well as on the source
+	// around them, as remaps do. Regions of such filters take whole rows.
+	virtual bool dependsOnPosition() const
+	{
+		return false;
+	}
 };
 
 class Kernel
@@ -25,6 +88,9 @@ class Kernel
 protected:
 	std::unique_ptr<float[]> data;
 	std::size_t radius;
+	// Rank-1 factors such that data[i * size + j] == vertical[i] * horizontal[j].
+	std::vector<float> horizontal, vertical;
+	bool separable = false;
 	std::size_t getLen() const
 	{
 		return getSize() * getSize();
@@ -38,6 +104,27 @@ public:
 	Kernel(const Kernel& other) : Kernel(other.radius)
 	{
 		std::copy(other.data.get(), other.data.get() + getLen(), data.get());
+		factorize();
+	}
+	// Tests whether the kernel is an outer product of two 1-D kernels and stores
+	// the factors. Runs on copy and in SetKernel; call it again after editing
+	// coefficients through operator[].
+	void factorize();
+	bool isSeparable() const
+	{
+		return separable;
+	}
+	const float* horizontalFactor() const
+	{
+		return horizontal.data();
+	}
+	const float* verticalFactor() const
+	{
+		return vertical.data();
+	}
+	const float* coefficients() const
+	{
+		return data.get();
 	}
 	std::size_t getRadius()const
 	{
@@ -57,6 +144,7 @@ public:
 		}
 		data = std::make_unique<float[]>(len);
 		std::copy(dataK, dataK + len, data.get());
+		factorize();
 	}
 	float operator [](std::size_t id) const
 	{
@@ -72,10 +160,79 @@ class MatrixFilter : public Filter
 {
 protected:
 	Kernel mKernel;
+	// False for filters that use the kernel as a window or structuring element
+	// (morphology, rank): processRows never hands them to the convolution
+	// engines and falls back to calcNewPixel instead.
+	bool convolves;
+	// Set when processRows takes the FFT, with the kernel spectra it reuses
+	// across bands and images.
+	std::shared_ptr<const FftKernel> fftKernel;
+	ConvolutionPrecision precision = ConvolutionPrecision::Float;
+	Border border;
 	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	QRgb calcNewPixel(const PixelView& img, int x, int y) const override;
+	// Separable kernels from radius 2 run as a horizontal and a vertical 1-D
+	// pass, other kernels with FftMinTaps non-zero taps through the FFT and
+	// everything else on the SIMD direct kernels. Filters that do not convolve
+	// take calcNewPixel.
+	void processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const override;
+	bool usesFFT() const
+	{
+		return fftKernel != nullptr;
+	}
 public:
-	MatrixFilter(const Kernel& kernel) : mKernel(kernel) {};
+	MatrixFilter(const Kernel& kernel, bool convolves = true) : mKernel(kernel), convolves(convolves)
+	{
+		int radius = int(mKernel.getRadius());
+		if (convolves && !mKernel.isSeparable() && prefersFFT(mKernel.coefficients(), radius))
+			fftKernel = std::make_shared<const FftKernel>(mKernel.coefficients(), radius);
+	}
 	virtual ~MatrixFilter() = default;
+	QImage process(const QImage& img) const override;
+	int halo() const override
+	{
+		return mKernel.getRadius();
+	}
+	bool isLocal() const override
+	{
+		return border.isLocal();
+	}
+	// How taps past the image edges read the source. Defaults to the nearest
+	// edge pixel.
+	void setBorder(const Border& value)
+	{
+		border = value;
+	}
+	// Fixed16 trades up to fixedPointErrorBound() levels of accuracy for
+	// 16-bit integer arithmetic in the direct path.
+	void setPrecision(ConvolutionPrecision value)
+	{
+		precision = value;
+	}
+};
+
+// MatrixFilter over a StaticKernel K. The fast path is unrolled at compile
+// time without the zero taps; mKernel holds the same coefficients for the
+// QColor path.
+template <class K>
+class StaticMatrixFilter : public MatrixFilter
+{
+	static Kernel runtimeKernel()
+	{
+		float coefficients[K::size * K::size];
+		for (int t = 0; t < K::size * K::size; t++)
+			coefficients[t] = float(K::coefficients[t]) / K::divisor;
+		Kernel kernel(K::radius);
+		kernel.SetKernel(coefficients, K::radius);
+		return kernel;
+	}
+protected:
+	void processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const override
+	{
+		convolveStatic<K>(src, dst, begin, end, border);
+	}
+public:
+	StaticMatrixFilter() : MatrixFilter(runtimeKernel()) {}
 };
 
 class BlurKernel : public Kernel
@@ -89,10 +246,24 @@ public:
 	}
 };
 
+// Box blur on running sums: the cost per pixel does not depend on the radius.
+// passes > 1 repeats the box, and three passes approximate a Gaussian with
+// sigma = radius. The sums are exact and divided by the area once, where the
+// former per-pixel convolution added 1 / area weights in float. Output can
+// therefore differ from it by one level where that rounding error crossed an
+// integer; edges are extended by border in both.
 class BlurFilter : public MatrixFilter
 {
+protected:
+	int passes;
+	void processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const override;
 public:
-	BlurFilter(std::size_t radius = 1) : MatrixFilter(BlurKernel(radius)) {}
+	BlurFilter(std::size_t radius = 1, int passes = 1) : MatrixFilter(BlurKernel(radius)), passes(passes) {}
+	QImage process(const QImage& img) const override;
+	int halo() const override
+	{
+		return mKernel.getRadius() * passes;
+	}
 };
 
 class GaussianKernel : public Kernel
@@ -125,21 +296,76 @@ public:
 	GaussianFilter(std::size_t radius = 2) : MatrixFilter(GaussianKernel(radius)) {}
 };
 
-class InvertFilter : public Filter
+// Filter whose output pixel depends only on the same input pixel. It compiles
+// to a PointLut applied in one table pass; PointChain fuses several of them.
+class PointFilter : public Filter
+{
+	friend class PointChain;
+	friend class Pipeline;
+protected:
+	// Whether compile() reads the histograms of its input.
+	virtual bool needsHistograms() const
+	{
+		return false;
+	}
+	// Per-channel table read back from calcNewPixel on a grey ramp; filters that
+	// mix channels override this.
+	virtual PointLut compile(const ChannelHistograms& input) const;
+public:
+	QImage process(const QImage& img) const override;
+	bool isLocal() const override
+	{
+		return !needsHistograms();
+	}
+};
+
+// Consecutive point filters run as one fused table. Stages are not owned and
+// must outlive the chain.
+class PointChain : public Filter
+{
+protected:
+	std::vector<const PointFilter*> stages;
+	// process() applies the fused table to every format, and the chain is not
+	// local, so nothing reaches the per-pixel path.
+	QColor calcNewPixelColor(const QImage& img, int x, int y) const override
+	{
+		throw std::logic_error("PointChain has no per-pixel path");
+	}
+public:
+	PointChain& then(const PointFilter& stage)
+	{
+		stages.push_back(&stage);
+		return *this;
+	}
+	QImage process(const QImage& img) const override;
+	bool isLocal() const override
+	{
+		return false;
+	}
+};
+
+class InvertFilter : public PointFilter
 {
 	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	QRgb calcNewPixel(const PixelView& img, int x, int y) const override;
 };
 
-class GrayScaleFilter : public Filter
+class GrayScaleFilter : public PointFilter
 {
+	QRgb fromIntensity(double Intensity) const;
 	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	QRgb calcNewPixel(const PixelView& img, int x, int y) const override;
+	PointLut compile(const ChannelHistograms& input) const override;
 };
 
-class Sepia : public Filter
+class Sepia : public PointFilter
 {
 protected:
 	int k;
+	QRgb fromIntensity(double Intensity) const;
 	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	QRgb calcNewPixel(const PixelView& img, int x, int y) const override;
+	PointLut compile(const ChannelHistograms& input) const override;
 public:
 	Sepia(int _k = 20)
 	{
@@ -147,11 +373,12 @@ public:
 	}
 };
 
-class Brightness : public Filter
+class Brightness : public PointFilter
 {
 protected:
 	int C;
 	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	QRgb calcNewPixel(const PixelView& img, int x, int y) const override;
 public:
 	Brightness(int _C = 30)
 	{
@@ -159,149 +386,147 @@ public:
 	}
 };
 
-class SobelX : public Kernel
+class SobelMatrixX : public StaticMatrixFilter<StaticKernel<1, 1,
+	-1, 0, 1,
+	-2, 0, 2,
+	-1, 0, 1>>
 {
-public:
-	using Kernel::Kernel;
-	SobelX() : Kernel(1)
-	{
-		data[0] = -1.f;
-		data[1] = 0.f;
-		data[2] = 1.f;
-		data[3] = -2.f;
-		data[4] = 0.f;
-		data[5] = 2.f;
-		data[6] = -1.f;
-		data[7] = 0.f;
-		data[8] = 1.f;
-	}
 };
 
-class SobelY : public Kernel
+class SobelMatrixY : public StaticMatrixFilter<StaticKernel<1, 1,
+	-1, -2, -1,
+	0, 0, 0,
+	1, 2, 1>>
 {
-public:
-	using Kernel::Kernel;
-	SobelY() : Kernel(1)
-	{
-		data[0] = -1.f;
-		data[1] = -2.f;
-		data[2] = -1.f;
-		data[3] = 0.f;
-		data[4] = 0.f;
-		data[5] = 0.f;
-		data[6] = 1.f;
-		data[7] = 2.f;
-		data[8] = 1.f;
-	}
-};
-
-class SobelMatrixX : public MatrixFilter
-{
-public:
-	SobelMatrixX() : MatrixFilter(SobelX()) {}
-};
-
-class SobelMatrixY : public MatrixFilter
-{
-public:
-	SobelMatrixY() : MatrixFilter(SobelY()) {}
 };
 
-class SharpnessKernel : public Kernel
+// Gray edge strength: the L2 Sobel magnitude of the luma, saturated at 255.
+class SobelEdges : public Filter
 {
+protected:
+	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	void processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const override;
 public:
-	using Kernel::Kernel;
-	SharpnessKernel() : Kernel(1)
+	int halo() const override
 	{
-		data[0] = 0.f;
-		data[1] = -1.f;
-		data[2] = 0.f;
-		data[3] = -1.f;
-		data[4] = 5.f;
-		data[5] = -1.f;
-		data[6] = 0.f;
-		data[7] = -1.f;
-		data[8] = 0.f;
+		return 1;
 	}
 };
 
-class Sharpness : public MatrixFilter
+class Sharpness : public StaticMatrixFilter<StaticKernel<1, 1,
+	0, -1, 0,
+	-1, 5, -1,
+	0, -1, 0>>
 {
-public:
-	Sharpness() : MatrixFilter(SharpnessKernel()) {}
 };
 
-class GreyWorld : public Filter
+class GreyWorld : public PointFilter
 {
 protected:
 	double Rs, Gs, Bs, AVG;
 	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	QRgb calcNewPixel(const PixelView& img, int x, int y) const override;
+	bool needsHistograms() const override
+	{
+		return true;
+	}
+	PointLut compile(const ChannelHistograms& input) const override;
 public:
-	QImage process(const QImage& img);
+	GreyWorld() : Rs(0), Gs(0), Bs(0), AVG(0) {}
 };
 
-class LinealStretching : public Filter
+class LinealStretching : public PointFilter
 {
 protected:
 	float maxR, maxG, maxB;
 	float minR, minG, minB;
 	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	QRgb calcNewPixel(const PixelView& img, int x, int y) const override;
 public:
-	LinealStretching(const QImage& img)
+	// Stretches the range of img, e.g. the image it will process.
+	LinealStretching(const QImage& img);
+};
+
+// Filters that only move pixels. Rows are gathered through a RemapTable built
+// once per image size and parameters and shared through cachedRemap().
+class RemapFilter : public Filter
+{
+protected:
+	Sampling sampling;
+	void processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const override;
+	// Names the map for the cache: the filter and every parameter it depends on.
+	virtual std::string remapKey() const = 0;
+	virtual RemapTable buildRemap(int width, int height) const = 0;
+public:
+	explicit RemapFilter(Sampling sampling = Sampling::Nearest) : sampling(sampling) {}
+	bool dependsOnPosition() const override
 	{
-		float tmpR = 0, tmpG = 0, tmpB = 0;
-		maxR = 0; maxG = 0; maxB = 0;
-		minR = 255; minG = 255; minB = 255;
-		for (int x = 0; x < img.width(); x++)
-			for (int y = 0; y < img.height(); y++)
-			{
-				QColor color = img.pixelColor(x, y);
-				tmpR = color.red();
-				tmpG = color.green();
-				tmpB = color.blue();
-				if (tmpR > maxR)
-					maxR = tmpR;
-				if (tmpG > maxG)
-					maxG = tmpG;
-				if (tmpB > maxB)
-					maxB = tmpB;
-				if (tmpR < minR)
-					minR = tmpR;
-				if (tmpG < minG)
-					minG = tmpG;
-				if (tmpB < minB)
-					minB = tmpB;
-			}
+		return true;
 	}
 };
 
-class HorizontalWaves :public Filter
+class HorizontalWaves : public RemapFilter
 {
-	QColor calcNewPixelColor(const QImage& img, int x, int y)  const override;
+protected:
+	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	std::string remapKey() const override;
+	RemapTable buildRemap(int width, int height) const override;
+public:
+	using RemapFilter::RemapFilter;
 };
 
-class VerticalWaves : public Filter
+class VerticalWaves : public RemapFilter
 {
-	QColor calcNewPixelColor(const QImage& img, int x, int y)  const override;
+protected:
+	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	std::string remapKey() const override;
+	RemapTable buildRemap(int width, int height) const override;
+public:
+	using RemapFilter::RemapFilter;
 };
 
-class Glass : public Filter
+// Moves every pixel by up to reach in x and y, drawn from PixelRandom(seed).
+class Glass : public RemapFilter
 {
 protected:
+	std::uint64_t seed;
+	double reach;
+	PixelRandom xRandom, yRandom;
 	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	std::string remapKey() const override;
+	RemapTable buildRemap(int width, int height) const override;
+	// Source position of output pixel (x, y), before clamping.
+	void source(int x, int y, double& sx, double& sy) const
+	{
+		sx = x + (xRandom.uniform(x, y) - 0.5) * 2 * reach;
+		sy = y + (yRandom.uniform(x, y) - 0.5) * 2 * reach;
+	}
+public:
+	explicit Glass(std::uint64_t seed = 0, Sampling sampling = Sampling::Nearest, double reach = 5) :
+		RemapFilter(sampling), seed(seed), reach(reach), xRandom(PixelRandom(seed).stream(0)), yRandom(PixelRandom(seed).stream(1)) {}
+	int halo() const override
+	{
+		return int(std::ceil(reach));
+	}
 };
 
-class Transfer : public Filter
+class Transfer : public RemapFilter
 {
 protected:
 	int x1, y1;
 	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	std::string remapKey() const override;
+	RemapTable buildRemap(int width, int height) const override;
 public:
-	Transfer(int _x1 = 50, int _y1 = 0)
+	Transfer(int _x1 = 50, int _y1 = 0, Sampling sampling = Sampling::Nearest) : RemapFilter(sampling)
 	{
 		x1 = _x1;
 		y1 = _y1;
 	}
+	int halo() const override
+	{
+		return std::abs(y1);
+	}
 };
 
 class DilationKernel : public Kernel
@@ -319,9 +544,20 @@ class Dilation : public MatrixFilter
 {
 protected:
 	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	// Rectangles of a flat kernel; empty for weighted kernels, which take
+	// weightedMorphology.
+	std::vector<MorphRect> rects;
+	QRgb calcNewPixel(const PixelView& img, int x, int y) const override;
+	void processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const override;
 public:
-	Dilation(std::size_t radius = 1) :MatrixFilter(DilationKernel(radius)) {}
-	Dilation(Kernel& ker) :MatrixFilter(ker) {}
+	Dilation(std::size_t radius = 1) : MatrixFilter(DilationKernel(radius), false)
+	{
+		rects = decomposeFlatKernel(mKernel.coefficients(), mKernel.getRadius());
+	}
+	Dilation(Kernel& ker) : MatrixFilter(ker, false)
+	{
+		rects = decomposeFlatKernel(mKernel.coefficients(), mKernel.getRadius());
+	}
 };
 
 class ErosionKernel : public Kernel
@@ -339,9 +575,24 @@ class Erosion : public MatrixFilter
 {
 protected:
 	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
-public:
-	Erosion(std::size_t radius = 1) : MatrixFilter(ErosionKernel(radius)) {}
-	Erosion(Kernel& ker) :MatrixFilter(ker) {}
+	// Rectangles of a flat kernel; empty for weighted kernels, which take
+	// weightedMorphology.
+	std::vector<MorphRect> rects;
+	// The kernel is flat (isFlatKernel), so its 0 taps are skipped.
+	bool flat;
+	QRgb calcNewPixel(const PixelView& img, int x, int y) const override;
+	void processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const override;
+public:
+	Erosion(std::size_t radius = 1) : MatrixFilter(ErosionKernel(radius), false)
+	{
+		flat = isFlatKernel(mKernel.coefficients(), mKernel.getRadius());
+		rects = decomposeFlatKernel(mKernel.coefficients(), mKernel.getRadius());
+	}
+	Erosion(Kernel& ker) : MatrixFilter(ker, false)
+	{
+		flat = isFlatKernel(mKernel.coefficients(), mKernel.getRadius());
+		rects = decomposeFlatKernel(mKernel.coefficients(), mKernel.getRadius());
+	}
 };
 
 class OpeningKernel : public Kernel
@@ -360,10 +611,23 @@ class Opening : public MatrixFilter
 {
 protected:
 	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	// The square element, made once rather than per band.
+	std::vector<MorphRect> rects;
+	void processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const override;
 public:
-	Opening(std::size_t radius = 1) : MatrixFilter(OpeningKernel(radius)) {}
-	Opening(Kernel& ker) :MatrixFilter(ker) {}
-	QImage process(const QImage& img) const;
+	Opening(std::size_t radius = 1) : MatrixFilter(OpeningKernel(radius), false)
+	{
+		rects = squareElement(mKernel.getRadius());
+	}
+	Opening(Kernel& ker) : MatrixFilter(ker, false)
+	{
+		rects = squareElement(mKernel.getRadius());
+	}
+	QImage process(const QImage& img) const override;
+	int halo() const override
+	{
+		return 2 * mKernel.getRadius();
+	}
 };
 
 class ClosingKernel : public Kernel
@@ -381,10 +645,23 @@ class Closing : public MatrixFilter
 {
 protected:
 	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	// The square element, made once rather than per band.
+	std::vector<MorphRect> rects;
+	void processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const override;
 public:
-	Closing(std::size_t radius = 1) : MatrixFilter(ClosingKernel(radius)) {}
-	Closing(Kernel& ker) :MatrixFilter(ker) {}
-	QImage process(const QImage& img) const;
+	Closing(std::size_t radius = 1) : MatrixFilter(ClosingKernel(radius), false)
+	{
+		rects = squareElement(mKernel.getRadius());
+	}
+	Closing(Kernel& ker) : MatrixFilter(ker, false)
+	{
+		rects = squareElement(mKernel.getRadius());
+	}
+	QImage process(const QImage& img) const override;
+	int halo() const override
+	{
+		return 2 * mKernel.getRadius();
+	}
 };
 
 class GradKernel : public Kernel
@@ -402,10 +679,19 @@ class Grad : public MatrixFilter
 {
 protected:
 	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	// The square element, made once rather than per band.
+	std::vector<MorphRect> rects;
+	void processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const override;
 public:
-	Grad(std::size_t radius = 1) : MatrixFilter(GradKernel(radius)) {}
-	Grad(Kernel& ker) :MatrixFilter(ker) {}
-	QImage process(const QImage& img) const;
+	Grad(std::size_t radius = 1) : MatrixFilter(GradKernel(radius), false)
+	{
+		rects = squareElement(mKernel.getRadius());
+	}
+	Grad(Kernel& ker) : MatrixFilter(ker, false)
+	{
+		rects = squareElement(mKernel.getRadius());
+	}
+	QImage process(const QImage& img) const override;
 };
 
 class MedianKernel : public Kernel
@@ -419,12 +705,23 @@ public:
 	}
 };
 
-class Median : public MatrixFilter
+// Percentile of each channel over the (2r+1)^2 window: 0 is the minimum,
+// 0.5 the median and 1 the maximum, e.g. RankFilter(3, 0.9f) for p90.
+class RankFilter : public MatrixFilter
 {
 protected:
+	float percentile;
+	int rank() const;
 	QColor calcNewPixelColor(const QImage& img, int x, int y) const override;
+	void processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const override;
+public:
+	RankFilter(std::size_t radius = 1, float percentile = 0.5f) : MatrixFilter(MedianKernel(radius), false), percentile(percentile) {}
+};
+
+class Median : public RankFilter
+{
 public:
-	Median(std::size_t radius = 1) : MatrixFilter(MedianKernel(radius)) {}
+	Median(std::size_t radius = 1) : RankFilter(radius, 0.5f) {}
 };
 
 class MotionBlurKernel : public Kernel
@@ -0,0 +1,299 @@
+#include "filterspec.h"
+#include <cctype>
+#include <cmath>
+
+namespace
+{
+	using Factory = std::unique_ptr<Filter>(*)(const FilterSpec::Stage& stage, const QImage& img, Kernel* structure);
+
+	// What the integer parameter of a filter means.
+	enum class Param
+	{
+		None,
+		Radius,	// a length in pixels, at least 1 when scaled
+		Offset,	// a length in pixels that may be negative
+		Value	// not a length: strength or seed
+	};
+
+	// Factories see stage.param filled in with fallback when the spec has none.
+	struct Entry
+	{
+		const char* name;
+		Param param;
+		int fallback;
+		Factory make;
+	};
+
+	template <class T>
+	std::unique_ptr<Filter> morphology(const FilterSpec::Stage& stage, const QImage&, Kernel* structure)
+	{
+		if (!stage.hasParam && structure)
+			return std::make_unique<T>(*structure);
+		return std::make_unique<T>(std::size_t(stage.param));
+	}
+
+	const Entry entries[] =
+	{
+		{ "Source", Param::None, 0, [](const FilterSpec::Stage&, const QImage&, Kernel*) -> std::unique_ptr<Filter> { return std::make_unique<Pipeline>(); } },
+		{ "Invert", Param::None, 0, [](const FilterSpec::Stage&, const QImage&, Kernel*) -> std::unique_ptr<Filter> { return std::make_unique<InvertFilter>(); } },
+		{ "Blur", Param::Radius, 1, [](const FilterSpec::Stage& s, const QImage&, Kernel*) -> std::unique_ptr<Filter> { return std::make_unique<BlurFilter>(s.param); } },
+		{ "Gaussian", Param::Radius, 2, [](const FilterSpec::Stage& s, const QImage&, Kernel*) -> std::unique_ptr<Filter> { return std::make_unique<GaussianFilter>(s.param); } },
+		{ "Gray", Param::None, 0, [](const FilterSpec::Stage&, const QImage&, Kernel*) -> std::unique_ptr<Filter> { return std::make_unique<GrayScaleFilter>(); } },
+		{ "Sepia", Param::Value, 20, [](const FilterSpec::Stage& s, const QImage&, Kernel*) -> std::unique_ptr<Filter> { return std::make_unique<Sepia>(s.param); } },
+		{ "Bright", Param::Value, 30, [](const FilterSpec::Stage& s, const QImage&, Kernel*) -> std::unique_ptr<Filter> { return std::make_unique<Brightness>(s.param); } },
+		{ "SobelX", Param::None, 0, [](const FilterSpec::Stage&, const QImage&, Kernel*) -> std::unique_ptr<Filter> { return std::make_unique<SobelMatrixX>(); } },
+		{ "SobelY", Param::None, 0, [](const FilterSpec::Stage&, const QImage&, Kernel*) -> std::unique_ptr<Filter> { return std::make_unique<SobelMatrixY>(); } },
+		{ "Edges", Param::None, 0, [](const FilterSpec::Stage&, const QImage&, Kernel*) -> std::unique_ptr<Filter> { return std::make_unique<SobelEdges>(); } },
+		{ "Sharpness", Param::None, 0, [](const FilterSpec::Stage&, const QImage&, Kernel*) -> std::unique_ptr<Filter> { return std::make_unique<Sharpness>(); } },
+		{ "GreyWorld", Param::None, 0, [](const FilterSpec::Stage&, const QImage&, Kernel*) -> std::unique_ptr<Filter> { return std::make_unique<GreyWorld>(); } },
+		{ "LinealStretching", Param::None, 0, [](const FilterSpec::Stage&, const QImage& img, Kernel*) -> std::unique_ptr<Filter> { return std::make_unique<LinealStretching>(img); } },
+		{ "HorizontalWaves", Param::None, 0, [](const FilterSpec::Stage& s, const QImage&, Kernel*) -> std::unique_ptr<Filter> { return std::make_unique<HorizontalWaves>(s.sampling); } },
+		{ "VerticalWaves", Param::None, 0, [](const FilterSpec::Stage& s, const QImage&, Kernel*) -> std::unique_ptr<Filter> { return std::make_unique<VerticalWaves>(s.sampling); } },
+		{ "Glass", Param::Value, 0, [](const FilterSpec::Stage& s, const QImage&, Kernel*) -> std::unique_ptr<Filter> { return std::make_unique<Glass>(s.param, s.sampling, std::ldexp(5.0, -s.level)); } },
+		{ "Transfer", Param::Offset, 50, [](const FilterSpec::Stage& s, const QImage&, Kernel*) -> std::unique_ptr<Filter> { return std::make_unique<Transfer>(s.param, 0, s.sampling); } },
+		{ "Dilation", Param::Radius, 1, morphology<Dilation> },
+		{ "Erosion", Param::Radius, 1, morphology<Erosion> },
+		{ "Opening", Param::Radius, 1, morphology<Opening> },
+		{ "Closing", Param::Radius, 1, morphology<Closing> },
+		{ "Gradient", Param::Radius, 1, morphology<Grad> },
+		{ "Median", Param::Radius, 1, [](const FilterSpec::Stage& s, const QImage&, Kernel*) -> std::unique_ptr<Filter> { return std::make_unique<Median>(s.param); } },
+		{ "MotionBlur", Param::Radius, 1, [](const FilterSpec::Stage& s, const QImage&, Kernel*) -> std::unique_ptr<Filter> { return std::make_unique<MotionBlur>(s.param); } },
+	};
+
+	// MatrixFilter and its subclasses.
+	bool takesBorder(const std::string& name)
+	{
+		static const char* const names[] = { "Blur", "Gaussian", "SobelX", "SobelY", "Sharpness", "Dilation",
+			"Erosion", "Opening", "Closing", "Gradient", "Median", "MotionBlur" };
+		return std::find(std::begin(names), std::end(names), name) != std::end(names);
+	}
+
+	// RemapFilter and its subclasses.
+	bool takesSampling(const std::string& name)
+	{
+		return name == "HorizontalWaves" || name == "VerticalWaves" || name == "Glass" || name == "Transfer";
+	}
+
+	const char* const borderNames[] = { "clamp", "mirror", "wrap", "constant" };
+	const char* const samplingNames[] = { "nearest", "bilinear" };
+
+	bool parseSampling(std::string text, Sampling& sampling)
+	{
+		std::transform(text.begin(), text.end(), text.begin(), [](char c) { return char(std::tolower(uchar(c))); });
+		for (int mode = 0; mode < 2; mode++)
+			if (text == samplingNames[mode])
+			{
+				sampling = Sampling(mode);
+				return true;
+			}
+		return false;
+	}
+
+	bool parseBorder(std::string text, Border& border)
+	{
+		std::transform(text.begin(), text.end(), text.begin(), [](char c) { return char(std::tolower(uchar(c))); });
+		std::string colour;
+		std::size_t equals = text.find('=');
+		if (equals != std::string::npos)
+		{
+			colour = text.substr(equals + 1);
+			text = text.substr(0, equals);
+			if (text != "constant" || colour.size() != 6 || colour.find_first_not_of("0123456789abcdef") != std::string::npos)
+				return false;
+		}
+		for (int mode = 0; mode < 4; mode++)
+			if (text == borderNames[mode])
+			{
+				border.mode = BorderMode(mode);
+				border.constant = 0xff000000u | (colour.empty() ? 0u : QRgb(std::stoul(colour, nullptr, 16)));
+				return true;
+			}
+		return false;
+	}
+
+	const Entry* find(const std::string& name)
+	{
+		for (const Entry& entry : entries)
+		{
+			std::string candidate = entry.name;
+			if (candidate.size() == name.size() && std::equal(name.begin(), name.end(), candidate.begin(),
+				[](char a, char b) { return std::tolower(uchar(a)) == std::tolower(uchar(b)); }))
+				return &entry;
+		}
+		return nullptr;
+	}
+
+	std::vector<std::string> split(const std::string& text, char separator)
+	{
+		std::vector<std::string> parts;
+		std::size_t start = 0;
+		for (;;)
+		{
+			std::size_t next = text.find(separator, start);
+			parts.push_back(text.substr(start, next == std::string::npos ? std::string::npos : next - start));
+			if (next == std::string::npos)
+				return parts;
+			start = next + 1;
+		}
+	}
+
+	// Owns the filters of a chained spec next to the pipeline that runs them.
+	class OwningPipeline : public Pipeline
+	{
+	public:
+		std::vector<std::unique_ptr<Filter>> owned;
+	};
+}
+
+const char* const FilterSpec::defaultList =
+	"Source,Invert,Blur,Gaussian,Gray,Sepia,Bright,SobelX,SobelY,Sharpness,GreyWorld,LinealStretching,"
+	"HorizontalWaves,VerticalWaves,Glass,Transfer,Dilation,Erosion,Opening,Closing,Gradient,Median,MotionBlur";
+
+FilterSpec::FilterSpec(const std::string& spec)
+{
+	for (const std::string& part : split(spec, '+'))
+	{
+		std::vector<std::string> fields = split(part, ':');
+		const Entry* entry = find(fields[0]);
+		if (!entry)
+			throw std::invalid_argument("unknown filter '" + fields[0] + "'");
+
+		Stage stage = { entry->name, 0, false, Border(), false, Sampling::Nearest, false, 0 };
+		for (std::size_t f = 1; f < fields.size(); f++)
+		{
+			const std::string& text = fields[f];
+			if (f + 1 == fields.size() && parseBorder(text, stage.border))
+			{
+				if (!takesBorder(stage.name))
+					throw std::invalid_argument(stage.name + " takes no border mode");
+				stage.hasBorder = true;
+				continue;
+			}
+			if (f + 1 == fields.size() && parseSampling(text, stage.sampling))
+			{
+				if (!takesSampling(stage.name))
+					throw std::invalid_argument(stage.name + " takes no sampling mode");
+				stage.hasSampling = true;
+				continue;
+			}
+			if (f > 1)
+				throw std::invalid_argument((takesSampling(stage.name) ? "bad sampling mode '" : "bad border mode '") + text + "' for " + stage.name);
+			stage.hasParam = true;
+			std::size_t used = 0;
+			try
+			{
+				stage.param = std::stoi(text, &used);
+			}
+			catch (const std::exception&)
+			{
+				used = 0;
+			}
+			if (used == 0 || used != text.size() || (entry->param != Param::Offset && entry->param != Param::Value && stage.param < 0))
+				throw std::invalid_argument("bad parameter '" + text + "' for " + stage.name);
+		}
+		stages.push_back(stage);
+	}
+}
+
+std::string FilterSpec::label() const
+{
+	std::string result;
+	for (const Stage& stage : stages)
+	{
+		if (!result.empty())
+			result += '-';
+		result += stage.name;
+		if (stage.hasParam)
+			result += std::to_string(stage.param);
+		if (stage.hasBorder)
+		{
+			std::string mode = borderNames[int(stage.border.mode)];
+			mode[0] = char(std::toupper(uchar(mode[0])));
+			result += mode;
+			if (stage.border.mode == BorderMode::Constant && (stage.border.constant & 0xffffffu))
+			{
+				char colour[7];
+				snprintf(colour, sizeof(colour), "%06x", unsigned(stage.border.constant & 0xffffffu));
+				result += colour;
+			}
+		}
+		if (stage.hasSampling)
+		{
+			std::string mode = samplingNames[int(stage.sampling)];
+			mode[0] = char(std::toupper(uchar(mode[0])));
+			result += mode;
+		}
+	}
+	return result;
+}
+
+std::unique_ptr<Filter> FilterSpec::build(const QImage& img, Kernel* structure) const
+{
+	auto make = [&](const Stage& stage)
+	{
+		const Entry* entry = find(stage.name);
+		Stage resolved = stage;
+		if (!resolved.hasParam)
+			resolved.param = entry->fallback;
+		std::unique_ptr<Filter> filter = entry->make(resolved, img, structure);
+		if (stage.hasBorder)
+			static_cast<MatrixFilter&>(*filter).setBorder(stage.border);
+		return filter;
+	};
+	if (stages.size() == 1)
+		return make(stages[0]);
+
+	std::unique_ptr<OwningPipeline> chain = std::make_unique<OwningPipeline>();
+	for (const Stage& stage : stages)
+	{
+		chain->owned.push_back(make(stage));
+		chain->then(*chain->owned.back());
+	}
+	return chain;
+}
+
+bool FilterSpec::dependsOnImage() const
+{
+	return std::any_of(stages.begin(), stages.end(), [](const Stage& stage) { return stage.name == "LinealStretching"; });
+}
+
+FilterSpec FilterSpec::atLevel(int level) const
+{
+	FilterSpec scaled = *this;
+	if (level <= 0)
+		return scaled;
+	for (Stage& stage : scaled.stages)
+	{
+		stage.level += level;
+		const Entry* entry = find(stage.name);
+		if (entry->param != Param::Radius && entry->param != Param::Offset)
+			continue;
+		int value = stage.hasParam ? stage.param : entry->fallback;
+		int result = int(std::lround(std::ldexp(double(value), -level)));
+		if (entry->param == Param::Radius && value > 0)
+			result = std::max(result, 1);
+		if (stage.hasParam || result != value)
+		{
+			stage.param = result;
+			stage.hasParam = true;
+		}
+	}
+	return scaled;
+}
+
+std::vector<FilterSpec> FilterSpec::parseList(const std::string& list)
+{
+	std::vector<FilterSpec> specs;
+	for (const std::string& spec : split(list, ','))
+		if (!spec.empty())
+			specs.emplace_back(spec);
+	return specs;
+}
+
+std::vector<std::string> FilterSpec::names()
+{
+	std::vector<std::string> result;
+	for (const Entry& entry : entries)
+		result.push_back(entry.name);
+	return result;
+}
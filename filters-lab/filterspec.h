@@ -0,0 +1,55 @@
+#pragma once
+#include "pipeline.h"
+#include <stdexcept>
+
+// Filters named on the command line. A spec is a filter name with an optional
+// integer parameter ("Blur:3", "Sepia:30"), or several of them chained with '+'
+// ("Gaussian+Sharpness+SobelX"), which run as one Pipeline. The parameter is
+// the radius, except for Sepia and Bright (strength), Transfer (x offset) and
+// Glass (random seed). Neighbourhood filters take a border mode as a last
+// field: "Median:2:mirror", "Blur:wrap", "Gaussian:3:constant=ff8000" (a hex
+// RGB colour, black without one). The default is clamp. Filters that move
+// pixels (HorizontalWaves, VerticalWaves, Glass, Transfer) take a sampling
+// mode there instead: "Glass:7:bilinear". The default is nearest.
+// Names are those of the files the default run writes, matched case-insensitively.
+class FilterSpec
+{
+public:
+	struct Stage
+	{
+		std::string name;
+		int param;
+		bool hasParam;
+		Border border;
+		bool hasBorder;
+		Sampling sampling;
+		bool hasSampling;
+		// Pyramid level the stage was scaled to by atLevel(), for lengths
+		// that are not the parameter, such as the reach of Glass.
+		int level;
+	};
+
+	// Throws std::invalid_argument for unknown names and malformed parameters.
+	explicit FilterSpec(const std::string& spec);
+	// Output file stem, e.g. "Blur3", "Median2Mirror" or "Gaussian-Sharpness".
+	std::string label() const;
+	// Builds the filter for one image; LinealStretching takes its range from it.
+	// Morphology stages without a parameter use structure when it is given.
+	std::unique_ptr<Filter> build(const QImage& img, Kernel* structure = nullptr) const;
+	// Whether build() depends on the image, so that a filter built for one
+	// frame of a video cannot be reused for the next.
+	bool dependsOnImage() const;
+	// The spec for an image downscaled by 2^level, as a Pyramid level: radii,
+	// the Transfer offset and the Glass displacement are divided by 2^level,
+	// radii rounded but staying at least 1. Morphology stages using the
+	// structuring element keep it.
+	FilterSpec atLevel(int level) const;
+
+	// Comma-separated specs.
+	static std::vector<FilterSpec> parseList(const std::string& list);
+	static std::vector<std::string> names();
+	// What main.cpp has always written for a single image.
+	static const char* const defaultList;
+private:
+	std::vector<Stage> stages;
+};
@@ -0,0 +1,400 @@
+#include "framestream.h"
+#include "boundedqueue.h"
+#include "netpbm.h"
+#include <exception>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace
+{
+	// Stream header of a Y4M sequence. The 4:2:0 variants only differ in chroma
+	// siting, which is ignored.
+	struct Y4MFormat
+	{
+		std::string header;
+		int width = 0, height = 0;
+		// log2 of the chroma subsampling in x and y.
+		int shiftX = 1, shiftY = 1;
+		bool mono = false;
+		// XCOLORRANGE=FULL; studio range otherwise.
+		bool fullRange = false;
+
+		int chromaWidth() const
+		{
+			return (width + (1 << shiftX) - 1) >> shiftX;
+		}
+		int chromaHeight() const
+		{
+			return (height + (1 << shiftY) - 1) >> shiftY;
+		}
+		std::size_t lumaBytes() const
+		{
+			return std::size_t(width) * height;
+		}
+		std::size_t chromaBytes() const
+		{
+			return mono ? 0 : std::size_t(chromaWidth()) * chromaHeight();
+		}
+		std::size_t frameBytes() const
+		{
+			return lumaBytes() + 2 * chromaBytes();
+		}
+	};
+
+	// One frame as read or as to be written. Y4M frames keep the parameters
+	// after FRAME, Netpbm frames their own header.
+	struct Frame
+	{
+		std::string params;
+		NetpbmHeader head;
+		ImagePool::Buffer bytes;
+		std::size_t size = 0;
+	};
+
+	int dimension(const std::string& text)
+	{
+		std::size_t used = 0;
+		int value = 0;
+		try
+		{
+			value = std::stoi(text, &used);
+		}
+		catch (const std::exception&)
+		{
+			used = 0;
+		}
+		if (used == 0 || used != text.size() || value <= 0)
+			throw std::runtime_error("bad Y4M size '" + text + "'");
+		return value;
+	}
+
+	Y4MFormat readY4MHeader(std::istream& in)
+	{
+		Y4MFormat format;
+		std::getline(in, format.header);
+		std::istringstream fields(format.header);
+		std::string field;
+		if (!(fields >> field) || field != "YUV4MPEG2")
+			throw std::runtime_error("not a Y4M stream");
+		while (fields >> field)
+		{
+			std::string value = field.substr(1);
+			if (field[0] == 'W')
+				format.width = dimension(value);
+			else if (field[0] == 'H')
+				format.height = dimension(value);
+			else if (field[0] == 'C')
+			{
+				if (value == "420" || value == "420jpeg" || value == "420paldv" || value == "420mpeg2")
+					format.shiftX = format.shiftY = 1;
+				else if (value == "422")
+				{
+					format.shiftX = 1;
+					format.shiftY = 0;
+				}
+				else if (value == "444")
+					format.shiftX = format.shiftY = 0;
+				else if (value == "mono")
+				{
+					format.mono = true;
+					format.shiftX = format.shiftY = 0;
+				}
+				else
+					throw std::runtime_error("unsupported Y4M colour space C" + value);
+			}
+			else if (field == "XCOLORRANGE=FULL")
+				format.fullRange = true;
+		}
+		if (format.width == 0 || format.height == 0)
+			throw std::runtime_error("Y4M header without W and H");
+		return format;
+	}
+
+	void readBytes(std::istream& in, Frame& frame, std::size_t size)
+	{
+		frame.size = size;
+		frame.bytes = ImagePool::shared().buffer(std::max<std::size_t>(size, 1));
+		in.read(frame.bytes.as<char>(), std::streamsize(size));
+		if (std::size_t(in.gcount()) != size)
+			throw std::runtime_error("truncated frame");
+	}
+
+	// False at the end of the stream.
+	bool readFrame(std::istream& in, const Y4MFormat* y4m, Frame& frame)
+	{
+		CGLAB_TRACE_SCOPE("read", "stream");
+		if (in.peek() == EOF)
+			return false;
+		if (y4m)
+		{
+			std::string line;
+			std::getline(in, line);
+			if (line.compare(0, 5, "FRAME") != 0)
+				throw std::runtime_error("bad Y4M frame header '" + line.substr(0, 16) + "'");
+			frame.params = line.substr(5);
+			readBytes(in, frame, y4m->frameBytes());
+		}
+		else
+		{
+			frame.head = NetpbmHeader::read(in);
+			readBytes(in, frame, frame.head.rowBytes() * frame.head.height);
+		}
+		return true;
+	}
+
+	void writeFrame(std::ostream& out, const Y4MFormat* y4m, const Frame& frame)
+	{
+		CGLAB_TRACE_SCOPE("write", "stream");
+		if (y4m)
+			out << "FRAME" << frame.params << '\n';
+		else
+			frame.head.write(out);
+		out.write(frame.bytes.as<const char>(), std::streamsize(frame.size));
+		if (!out)
+			throw std::runtime_error("cannot write the output stream");
+	}
+
+	uchar saturate(int value)
+	{
+		return uchar(std::min(std::max(value, 0), 255));
+	}
+
+	// BT.601 with 8 fractional bits.
+	QRgb yuvToRgb(int y, int u, int v, bool full)
+	{
+		int d = u - 128, e = v - 128;
+		int r, g, b;
+		if (full)
+		{
+			y <<= 8;
+			r = y + 359 * e;
+			g = y - 88 * d - 183 * e;
+			b = y + 454 * d;
+		}
+		else
+		{
+			y = 298 * (y - 16);
+			r = y + 409 * e;
+			g = y - 100 * d - 208 * e;
+			b = y + 516 * d;
+		}
+		return qRgb(saturate((r + 128) >> 8), saturate((g + 128) >> 8), saturate((b + 128) >> 8));
+	}
+
+	uchar luma(int r, int g, int b, bool full)
+	{
+		if (full)
+			return saturate((77 * r + 150 * g + 29 * b + 128) >> 8);
+		return saturate(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+	}
+
+	void chroma(int r, int g, int b, bool full, uchar& u, uchar& v)
+	{
+		if (full)
+		{
+			u = saturate(((-43 * r - 85 * g + 128 * b + 128) >> 8) + 128);
+			v = saturate(((128 * r - 107 * g - 21 * b + 128) >> 8) + 128);
+		}
+		else
+		{
+			u = saturate(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+			v = saturate(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+		}
+	}
+
+	void unpackY4M(const Y4MFormat& format, const uchar* bytes, QImage& image)
+	{
+		int w = format.width, cw = format.chromaWidth();
+		const uchar* planeU = bytes + format.lumaBytes();
+		const uchar* planeV = planeU + format.chromaBytes();
+		forEachBand(format.height, [&](int begin, int end)
+		{
+			for (int y = begin; y < end; y++)
+			{
+				const uchar* lumaRow = bytes + std::size_t(y) * w;
+				QRgb* out = reinterpret_cast<QRgb*>(image.scanLine(y));
+				if (format.mono)
+				{
+					for (int x = 0; x < w; x++)
+						out[x] = yuvToRgb(lumaRow[x], 128, 128, format.fullRange);
+					continue;
+				}
+				std::size_t chromaRow = std::size_t(y >> format.shiftY) * cw;
+				const uchar* u = planeU + chromaRow;
+				const uchar* v = planeV + chromaRow;
+				for (int x = 0; x < w; x++)
+					out[x] = yuvToRgb(lumaRow[x], u[x >> format.shiftX], v[x >> format.shiftX], format.fullRange);
+			}
+		});
+	}
+
+	// Works in whole chroma rows, so that each band owns the luma rows it averages.
+	void packY4M(const Y4MFormat& format, const QImage& image, uchar* bytes)
+	{
+		int w = format.width, h = format.height, cw = format.chromaWidth();
+		int sx = format.shiftX, sy = format.shiftY;
+		uchar* planeU = bytes + format.lumaBytes();
+		uchar* planeV = planeU + format.chromaBytes();
+		int chromaRows = format.chromaHeight();
+		ThreadPool::shared().parallelFor(0, chromaRows, bandHeight(chromaRows), [&](int begin, int end)
+		{
+			CGLAB_TRACE_SCOPE("pack", "band");
+			for (int cy = begin; cy < end; cy++)
+			{
+				int y0 = cy << sy, y1 = std::min(h, (cy + 1) << sy);
+				for (int y = y0; y < y1; y++)
+				{
+					const QRgb* in = reinterpret_cast<const QRgb*>(image.constScanLine(y));
+					uchar* out = bytes + std::size_t(y) * w;
+					for (int x = 0; x < w; x++)
+						out[x] = luma(qRed(in[x]), qGreen(in[x]), qBlue(in[x]), format.fullRange);
+				}
+				if (format.mono)
+					continue;
+				for (int cx = 0; cx < cw; cx++)
+				{
+					int x0 = cx << sx, x1 = std::min(w, (cx + 1) << sx);
+					int r = 0, g = 0, b = 0;
+					for (int y = y0; y < y1; y++)
+					{
+						const QRgb* in = reinterpret_cast<const QRgb*>(image.constScanLine(y));
+						for (int x = x0; x < x1; x++)
+						{
+							r += qRed(in[x]);
+							g += qGreen(in[x]);
+							b += qBlue(in[x]);
+						}
+					}
+					int n = (x1 - x0) * (y1 - y0);
+					chroma((r + n / 2) / n, (g + n / 2) / n, (b + n / 2) / n, format.fullRange,
+						planeU[std::size_t(cy) * cw + cx], planeV[std::size_t(cy) * cw + cx]);
+				}
+			}
+		});
+	}
+}
+
+int FrameStream::run(std::istream& in, std::ostream& out) const
+{
+	if (in.peek() == EOF)
+		return 0;
+	Y4MFormat format;
+	const Y4MFormat* y4m = nullptr;
+	if (in.peek() == 'Y')
+	{
+		format = readY4MHeader(in);
+		y4m = &format;
+		out << format.header << '\n';
+	}
+
+	BoundedQueue<Frame> input(queueDepth);
+	BoundedQueue<Frame> output(queueDepth);
+	std::exception_ptr readError, writeError;
+	int written = 0;
+
+	std::thread reader([&]
+	{
+		try
+		{
+			Frame frame;
+			while (readFrame(in, y4m, frame) && input.push(std::move(frame)))
+				frame = Frame();
+		}
+		catch (...)
+		{
+			readError = std::current_exception();
+		}
+		input.close();
+	});
+
+	std::thread writer([&]
+	{
+		try
+		{
+			Frame frame;
+			while (output.pop(frame))
+			{
+				writeFrame(out, y4m, frame);
+				written++;
+			}
+			out.flush();
+			if (!out)
+				throw std::runtime_error("cannot write the output stream");
+		}
+		catch (...)
+		{
+			writeError = std::current_exception();
+		}
+		// Stops the filter loop and, through it, the reader.
+		output.close();
+	});
+
+	std::exception_ptr filterError;
+	try
+	{
+		std::unique_ptr<Filter> filter;
+		bool rebuild = spec.dependsOnImage();
+		Frame frame;
+		while (input.pop(frame))
+		{
+			int w = y4m ? format.width : frame.head.width;
+			int h = y4m ? format.height : frame.head.height;
+			QImage image = ImagePool::shared().image(w, h, QImage::Format_ARGB32);
+			if (y4m)
+				unpackY4M(format, frame.bytes.as<uchar>(), image);
+			else
+			{
+				const uchar* bytes = frame.bytes.as<uchar>();
+				std::size_t rowBytes = frame.head.rowBytes();
+				int channels = frame.head.channels;
+				forEachBand(h, [&](int begin, int end)
+				{
+					for (int y = begin; y < end; y++)
+						unpackRow(bytes + y * rowBytes, w, channels, reinterpret_cast<QRgb*>(image.scanLine(y)));
+				});
+			}
+			// The read buffer goes back to the pool for the reader's next frame.
+			frame.bytes = ImagePool::Buffer();
+
+			if (!filter || rebuild)
+				filter = spec.build(image, structure);
+			QImage result = filter->process(image);
+			image = QImage();
+
+			Frame done;
+			done.params = std::move(frame.params);
+			done.head = frame.head;
+			done.size = y4m ? format.frameBytes() : frame.head.rowBytes() * h;
+			done.bytes = ImagePool::shared().buffer(std::max<std::size_t>(done.size, 1));
+			if (y4m)
+				packY4M(format, result, done.bytes.as<uchar>());
+			else
+			{
+				uchar* bytes = done.bytes.as<uchar>();
+				std::size_t rowBytes = done.head.rowBytes();
+				int channels = done.head.channels;
+				forEachBand(h, [&](int begin, int end)
+				{
+					for (int y = begin; y < end; y++)
+						packRow(reinterpret_cast<const QRgb*>(result.constScanLine(y)), w, channels, bytes + y * rowBytes);
+				});
+			}
+			if (!output.push(std::move(done)))
+				break;
+		}
+	}
+	catch (...)
+	{
+		filterError = std::current_exception();
+	}
+	input.close();
+	output.close();
+	reader.join();
+	writer.join();
+
+	for (const std::exception_ptr& error : { filterError, readError, writeError })
+		if (error)
+			std::rethrow_exception(error);
+	return written;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "filterspec.h"
+#include <istream>
+#include <ostream>
+
+// Filters a video sequence piped through the process: a YUV4MPEG2 (Y4M) stream,
+// or concatenated PAM / PPM / PGM frames as ffmpeg's image2pipe writes them,
+// is read from in and written to out in the same format and size. Reading frame
+// N + 1 and writing frame N - 1 overlap filtering frame N on their own threads.
+// Frame buffers and images come from ImagePool, so a stream of one frame size
+// runs without allocating, and the filter is built once, so kernels and remap
+// tables carry over between frames. Specs with LinealStretching are rebuilt per
+// frame, as its range comes from the image.
+class FrameStream
+{
+	const FilterSpec& spec;
+	Kernel* structure;
+	int queueDepth;
+public:
+	explicit FrameStream(const FilterSpec& spec, Kernel* structure = nullptr, int queueDepth = 2) :
+		spec(spec), structure(structure), queueDepth(queueDepth) {}
+
+	// Y4M input may be 8-bit mono, 4:2:0, 4:2:2 or 4:4:4; chroma is upsampled
+	// by replication and averaged back down on output. Returns the number of
+	// frames written. Throws std::runtime_error on malformed or truncated input
+	// and write errors.
+	int run(std::istream& in, std::ostream& out) const;
+};
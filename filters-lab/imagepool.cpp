@@ -0,0 +1,212 @@
+#include "imagepool.h"
+#include "trace.h"
+#include <cstdint>
+#include <new>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+	const std::size_t Alignment = 64;
+	const std::size_t HugePage = std::size_t(2) << 20;
+
+	std::size_t alignUp(std::size_t value, std::size_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+}
+
+struct ImagePool::Block
+{
+	ImagePool* pool;
+	void* data;
+	std::size_t bytes;
+	// Length of the mapping when the block came from mmap, else 0.
+	std::size_t mapped;
+};
+
+ImagePool::Buffer& ImagePool::Buffer::operator=(Buffer&& other) noexcept
+{
+	if (this != &other)
+	{
+		if (block)
+			pool->release(block);
+		pool = other.pool;
+		block = other.block;
+		other.block = nullptr;
+	}
+	return *this;
+}
+
+ImagePool::Buffer::~Buffer()
+{
+	if (block)
+		pool->release(block);
+}
+
+void* ImagePool::Buffer::data() const
+{
+	return block ? block->data : nullptr;
+}
+
+ImagePool::~ImagePool()
+{
+	trim();
+}
+
+ImagePool& ImagePool::shared()
+{
+	static ImagePool* pool = new ImagePool();
+	return *pool;
+}
+
+ImagePool::Block* ImagePool::acquire(std::size_t bytes)
+{
+	bytes = alignUp(std::max<std::size_t>(bytes, 1), Alignment);
+	bool huge;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		auto found = idle.find(bytes);
+		if (found != idle.end() && !found->second.empty())
+		{
+			Block* block = found->second.back();
+			found->second.pop_back();
+			idleBytes -= bytes;
+			stats.hits++;
+			return block;
+		}
+		stats.misses++;
+		stats.bytes += bytes;
+		stats.peakBytes = std::max(stats.peakBytes, stats.bytes);
+		huge = hugePages;
+	}
+
+	// Allocated outside the lock; the page faults come later, on first write.
+	CGLAB_TRACE_ALLOCATED(bytes);
+	Block* block = new Block{ this, nullptr, bytes, 0 };
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+	if (huge && bytes >= HugePage)
+	{
+		// mmap only aligns to the base page, and the kernel backs only the
+		// 2 MB-aligned stretches of a range with huge pages. Mapping one huge
+		// page more and unmapping the slack on both sides leaves an aligned
+		// range that is huge pages throughout.
+		std::size_t length = alignUp(bytes, HugePage);
+		void* data = mmap(nullptr, length + HugePage, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (data != MAP_FAILED)
+		{
+			char* start = static_cast<char*>(data);
+			char* aligned = reinterpret_cast<char*>(alignUp(reinterpret_cast<std::uintptr_t>(start), HugePage));
+			if (aligned > start)
+				munmap(start, std::size_t(aligned - start));
+			if (std::size_t tail = std::size_t(start + length + HugePage - (aligned + length)))
+				munmap(aligned + length, tail);
+			madvise(aligned, length, MADV_HUGEPAGE);
+			block->data = aligned;
+			block->mapped = length;
+			return block;
+		}
+	}
+#else
+	(void)huge;
+#endif
+	block->data = ::operator new(bytes, std::align_val_t(Alignment));
+	return block;
+}
+
+void ImagePool::release(Block* block)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (idleBytes + block->bytes <= idleLimit)
+		{
+			idle[block->bytes].push_back(block);
+			idleBytes += block->bytes;
+			return;
+		}
+		stats.bytes -= block->bytes;
+	}
+	destroy(block);
+}
+
+void ImagePool::destroy(Block* block)
+{
+#if defined(__linux__)
+	if (block->mapped)
+		munmap(block->data, block->mapped);
+	else
+#endif
+		::operator delete(block->data, std::align_val_t(Alignment));
+	delete block;
+}
+
+void ImagePool::cleanup(void* info)
+{
+	Block* block = static_cast<Block*>(info);
+	block->pool->release(block);
+}
+
+QImage ImagePool::image(int width, int height, QImage::Format format)
+{
+	if (width <= 0 || height <= 0)
+		return QImage(width, height, format);
+	int bits = QImage::toPixelFormat(format).bitsPerPixel();
+	std::size_t stride = alignUp((std::size_t(width) * bits + 7) / 8, Alignment);
+	Block* block = acquire(stride * height);
+	return QImage(static_cast<uchar*>(block->data), width, height, qsizetype(stride), format, cleanup, block);
+}
+
+ImagePool::Buffer ImagePool::buffer(std::size_t bytes)
+{
+	return Buffer(this, acquire(bytes));
+}
+
+ImagePool::Counters ImagePool::counters() const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return stats;
+}
+
+void ImagePool::resetCounters()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	stats.hits = 0;
+	stats.misses = 0;
+	stats.peakBytes = stats.bytes;
+}
+
+void ImagePool::setIdleLimit(std::size_t bytes)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		idleLimit = bytes;
+		if (idleBytes <= idleLimit)
+			return;
+	}
+	trim();
+}
+
+void ImagePool::setHugePages(bool enabled)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	hugePages = enabled;
+}
+
+void ImagePool::trim()
+{
+	std::vector<Block*> freed;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		for (auto& entry : idle)
+		{
+			freed.insert(freed.end(), entry.second.begin(), entry.second.end());
+			entry.second.clear();
+		}
+		stats.bytes -= idleBytes;
+		idleBytes = 0;
+	}
+	for (Block* block : freed)
+		destroy(block);
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <QImage>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// Recycles the pixel storage of filter outputs and scratch images, so that a
+// service processing images of one size reaches a steady state without
+// allocating or faulting in pixel memory. Buffers are 64-byte aligned and
+// keyed by their size in bytes alone, not by image size and format: an image
+// reuses any idle buffer of its byte count, whatever shape or format held it
+// before. Pooled images also start every row on a 64-byte boundary. A buffer returns to the pool when the last QImage sharing
+// it is destroyed. Writing to a shared copy detaches it into ordinary heap
+// storage, as with any QImage.
+class ImagePool
+{
+	struct Block;
+public:
+	struct Counters
+	{
+		// Requests served from an idle buffer, and requests that allocated one.
+		long long hits = 0;
+		long long misses = 0;
+		// Bytes the pool has allocated, in use or idle, and their maximum.
+		std::size_t bytes = 0;
+		std::size_t peakBytes = 0;
+	};
+
+	// Scratch memory held for one scope.
+	class Buffer
+	{
+		friend class ImagePool;
+		ImagePool* pool = nullptr;
+		Block* block = nullptr;
+		Buffer(ImagePool* pool, Block* block) : pool(pool), block(block) {}
+	public:
+		Buffer() = default;
+		Buffer(Buffer&& other) noexcept : pool(other.pool), block(other.block)
+		{
+			other.block = nullptr;
+		}
+		Buffer& operator=(Buffer&& other) noexcept;
+		~Buffer();
+		void* data() const;
+		template <class T>
+		T* as() const
+		{
+			return static_cast<T*>(data());
+		}
+	};
+
+	ImagePool() = default;
+	// Images from the pool must not outlive it.
+	~ImagePool();
+	ImagePool(const ImagePool&) = delete;
+	ImagePool& operator=(const ImagePool&) = delete;
+
+	// Uninitialised image; 32-bit and 8-bit formats only need bytesPerLine to
+	// be a multiple of 4, which 64 is.
+	QImage image(int width, int height, QImage::Format format);
+	QImage image(const QSize& size, QImage::Format format)
+	{
+		return image(size.width(), size.height(), format);
+	}
+	// Uninitialised scratch memory of at least bytes bytes.
+	Buffer buffer(std::size_t bytes);
+
+	Counters counters() const;
+	void resetCounters();
+	// Idle bytes kept for reuse; buffers released beyond it are freed.
+	// Defaults to 256 MB.
+	void setIdleLimit(std::size_t bytes);
+	// Back buffers of 2 MB and more with transparent huge pages where the OS
+	// offers them (Linux). Affects buffers allocated from now on.
+	void setHugePages(bool enabled);
+	// Frees every idle buffer.
+	void trim();
+
+	// The pool filters and pipelines draw from. Never destroyed, so images
+	// may outlive static destruction.
+	static ImagePool& shared();
+private:
+	mutable std::mutex lock;
+	// Idle blocks by size. Vectors keep their capacity, so steady-state
+	// reuse allocates nothing.
+	std::map<std::size_t, std::vector<Block*>> idle;
+	std::size_t idleBytes = 0;
+	std::size_t idleLimit = std::size_t(256) << 20;
+	bool hugePages = false;
+	Counters stats;
+
+	Block* acquire(std::size_t bytes);
+	void release(Block* block);
+	void destroy(Block* block);
+	static void cleanup(void* info);
+};
@@ -0,0 +1,116 @@
+#include "imagestats.h"
+#include "filter.h"
+#include <list>
+#include <mutex>
+
+namespace
+{
+	const std::size_t CacheEntries = 16;
+
+	// Four interleaved copies of each histogram, so that runs of equal pixels
+	// do not serialise on one counter.
+	struct PartialHistograms
+	{
+		unsigned int counts[4][3][256];
+	};
+
+	void countRows(const PixelView& src, int begin, int end, ChannelHistograms& into)
+	{
+		std::unique_ptr<PartialHistograms> part(new PartialHistograms());
+		int w = src.width();
+		for (int y = begin; y < end; y++)
+		{
+			const QRgb* row = src.row(y);
+			int x = 0;
+			for (; x + 4 <= w; x += 4)
+				for (int k = 0; k < 4; k++)
+				{
+					QRgb color = row[x + k];
+					part->counts[k][0][qRed(color)]++;
+					part->counts[k][1][qGreen(color)]++;
+					part->counts[k][2][qBlue(color)]++;
+				}
+			for (; x < w; x++)
+			{
+				QRgb color = row[x];
+				part->counts[0][0][qRed(color)]++;
+				part->counts[0][1][qGreen(color)]++;
+				part->counts[0][2][qBlue(color)]++;
+			}
+		}
+		for (int c = 0; c < 3; c++)
+			for (int v = 0; v < 256; v++)
+				into.counts[c][v] += part->counts[0][c][v] + part->counts[1][c][v] + part->counts[2][c][v] + part->counts[3][c][v];
+		into.pixels += (long long)w * (end - begin);
+	}
+
+	struct CacheEntry
+	{
+		qint64 key;
+		std::shared_ptr<const ImageStats> stats;
+	};
+
+	std::mutex cacheLock;
+	// Most recently used first.
+	std::list<CacheEntry> cache;
+}
+
+ImageStats ImageStats::compute(const QImage& img)
+{
+	if (!PixelView::isSupported(img.format()))
+		return compute(img.convertToFormat(QImage::Format_ARGB32));
+
+	CGLAB_TRACE_SCOPE("ImageStats", "stats");
+	// 32-bit counters per band, merged in row order.
+	PixelView src(img);
+	int band = bandHeight(img.height());
+	std::vector<ChannelHistograms> bands((img.height() + band - 1) / band);
+	forEachBand(img.height(), [&](int begin, int end)
+	{
+		countRows(src, begin, end, bands[begin / band]);
+	});
+
+	ImageStats stats;
+	for (const ChannelHistograms& part : bands)
+		stats.histograms.add(part);
+	for (int c = 0; c < 3; c++)
+	{
+		const long long* counts = stats.histograms.counts[c];
+		stats.min[c] = 255;
+		stats.max[c] = 0;
+		for (int v = 0; v < 256; v++)
+			if (counts[v])
+			{
+				stats.min[c] = std::min(stats.min[c], v);
+				stats.max[c] = v;
+			}
+		stats.sum[c] = stats.histograms.sum(c);
+	}
+	return stats;
+}
+
+std::shared_ptr<const ImageStats> imageStats(const QImage& img)
+{
+	qint64 key = img.cacheKey();
+	{
+		std::lock_guard<std::mutex> guard(cacheLock);
+		for (auto entry = cache.begin(); entry != cache.end(); ++entry)
+			if (entry->key == key)
+			{
+				cache.splice(cache.begin(), cache, entry);
+				return entry->stats;
+			}
+	}
+
+	// Computed outside the lock: the pass runs on the pool, and a thread
+	// waiting for it may pick up work that asks for other statistics.
+	std::shared_ptr<const ImageStats> stats = std::make_shared<const ImageStats>(ImageStats::compute(img));
+	std::lock_guard<std::mutex> guard(cacheLock);
+	for (const CacheEntry& entry : cache)
+		if (entry.key == key)
+			return entry.stats;
+	cache.push_front({ key, stats });
+	if (cache.size() > CacheEntries)
+		cache.pop_back();
+	return stats;
+}
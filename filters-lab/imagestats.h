@@ -0,0 +1,26 @@
+#pragma once
+#include "pointop.h"
+#include <memory>
+
+// Per-channel statistics of an image. One parallel pass collects the
+// histograms; min, max and sum follow from them. An empty image has min 255
+// and max 0.
+struct ImageStats
+{
+	ChannelHistograms histograms;
+	int min[3];
+	int max[3];
+	long long sum[3];
+
+	double mean(int c) const
+	{
+		return histograms.pixels ? double(sum[c]) / histograms.pixels : 0;
+	}
+
+	static ImageStats compute(const QImage& img);
+};
+
+// Statistics of img, cached by QImage::cacheKey(), which changes whenever the
+// image is modified. Filters that need statistics of the same image share one
+// pass over it.
+std::shared_ptr<const ImageStats> imageStats(const QImage& img);
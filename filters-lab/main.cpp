@@ -1,15 +1,57 @@
-#include "filter.h"
-
+#include "batch.h"
+#include "framestream.h"
+#include "strips.h"
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// -p image           filter one image, outputs go straight to the output root
+// -d dir | -m list   filter every image under dir / listed in a manifest
+// -f specs           comma-separated filters, see FilterSpec (default: all)
+// -o root            output root (default: Images)
+// -t N               threads of the shared pool
+// -e N               PNG encoder threads
+// -s out -r rows     stream the Netpbm image given by -p through one filter
+//                    spec into out, holding strips of rows (default 256);
+//                    specs measured from the image (LinealStretching) are refused
+// -v                 filter a Y4M or PAM/PPM frame stream from stdin to stdout
+//                    through one filter spec, e.g. ffmpeg ... -f yuv4mpegpipe -
+// -T trace.json      write a Chrome trace and print a timing summary
+//                    (needs a build with CGLAB_TRACE defined)
 int main(int argc, char* argv[])
 {
-    std::string s;
-    QImage img;
+    std::string s, dir, manifest, streamed, tracePath;
+    int stripRows = 256;
+    bool video = false;
+    std::string specs = FilterSpec::defaultList;
+    BatchOptions options;
 
 
     for (int i = 0; i < argc; i++)
     {
         if (!strcmp(argv[i], "-p") && (i + 1 < argc))
             s = argv[i + 1];
+        if (!strcmp(argv[i], "-d") && (i + 1 < argc))
+            dir = argv[i + 1];
+        if (!strcmp(argv[i], "-m") && (i + 1 < argc))
+            manifest = argv[i + 1];
+        if (!strcmp(argv[i], "-f") && (i + 1 < argc))
+            specs = argv[i + 1];
+        if (!strcmp(argv[i], "-o") && (i + 1 < argc))
+            options.outputRoot = std::filesystem::u8path(argv[i + 1]);
+        if (!strcmp(argv[i], "-t") && (i + 1 < argc))
+            ThreadPool::setSharedThreadCount(std::atoi(argv[i + 1]));
+        if (!strcmp(argv[i], "-e") && (i + 1 < argc))
+            options.encoders = std::atoi(argv[i + 1]);
+        if (!strcmp(argv[i], "-s") && (i + 1 < argc))
+            streamed = argv[i + 1];
+        if (!strcmp(argv[i], "-r") && (i + 1 < argc))
+            stripRows = std::atoi(argv[i + 1]);
+        if (!strcmp(argv[i], "-T") && (i + 1 < argc))
+            tracePath = argv[i + 1];
+        if (!strcmp(argv[i], "-v"))
+            video = true;
     }
     char size[80];
     std::ifstream ifs("KernelM.txt");
@@ -23,78 +65,120 @@ int main(int argc, char* argv[])
         tmp[i] = std::atoi(size);
     }
 
-    MatKernel.SetKernel(tmp.get(), sizei / 2);
-
-    img.load(QString(s.c_str()));
-    img.save("Images/Source.png");
-
-    InvertFilter invert;
-    invert.process(img).save("C:/Users/Admin/source/repos/filters-lab/filters-lab/Images/Invert.png");
-
-    BlurFilter blur;
-    blur.process(img).save("C:/Users/Admin/source/repos/filters-lab/filters-lab/Images/Blur.png");
-
-    GaussianFilter gaussian;
-    gaussian.process(img).save("C:/Users/Admin/source/repos/filters-lab/filters-lab/Images/Gaussian.png");
-
-    GrayScaleFilter gray;
-    gray.process(img).save("C:/Users/Admin/source/repos/filters-lab/filters-lab/Images/Gray.png");
-
-    Sepia sepia_img;
-    sepia_img.process(img).save("C:/Users/Admin/source/repos/filters-lab/filters-lab/Images/Sepia.png");
-
-    Brightness bright;
-    bright.process(img).save("C:/Users/Admin/source/repos/filters-lab/filters-lab/Images/Bright.png");
-
-    SobelMatrixX sobelX;
-    sobelX.process(img).save("C:/Users/Admin/source/repos/filters-lab/filters-lab/Images/SobelX.png");
-
-    SobelMatrixY sobelY;
-    sobelY.process(img).save("C:/Users/Admin/source/repos/filters-lab/filters-lab/Images/SobelY.png");
-
-    Sharpness sharp;
-    sharp.process(img).save("C:/Users/Admin/source/repos/filters-lab/filters-lab/Images/Sharpness.png");
-
-    GreyWorld grey;
-    grey.process(img).save("C:/Users/Admin/source/repos/filters-lab/filters-lab/Images/GreyWorld.png");
-
-    LinealStretching lineal(img);
-    lineal.process(img).save("C:/Users/Admin/source/repos/filters-lab/filters-lab/Images/LinealStretching.png");
-
-    HorizontalWaves hwaves;
-    //hwaves.process(img).save("C:/Users/Admin/source/repos/filters-lab/filters-lab/Images/HorizontalWaves.png");
-
-    VerticalWaves vwaves;
-    //vwaves.process(img).save("C:/Users/Admin/source/repos/filters-lab/filters-lab/Images/VerticalWaves.png");
-
-    Glass gl;
-    gl.process(img).save("C:/Users/Admin/source/repos/filters-lab/filters-lab/Images/Glass.png");
-
-    Transfer transf;
-    transf.process(img).save("C:/Users/Admin/source/repos/filters-lab/filters-lab/Images/Transfer.png");
-
-    Dilation dil(MatKernel);
-    dil.process(img).save("C:/Users/Admin/source/repos/filters-lab/filters-lab/Images/Dilation.png");
-
-    Erosion eros(MatKernel);
-    eros.process(img).save("C:/Users/Admin/source/repos/filters-lab/filters-lab/Images/Erosion.png");
+    if (sizei > 0)
+    {
+        MatKernel.SetKernel(tmp.get(), sizei / 2);
+        options.structure = &MatKernel;
+    }
 
-    Opening op(MatKernel);
-    op.process(img).save("C:/Users/Admin/source/repos/filters-lab/filters-lab/Images/Opening.png");
+    try
+    {
+        options.filters = FilterSpec::parseList(specs);
+    }
+    catch (const std::invalid_argument& error)
+    {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
 
-    Closing cl(MatKernel);
-    cl.process(img).save("C:/Users/Admin/source/repos/filters-lab/filters-lab/Images/Closing.png");
+    if (!tracePath.empty())
+    {
+#if defined(CGLAB_TRACE)
+        Trace::start();
+#else
+        std::cerr << "-T ignored: built without CGLAB_TRACE" << std::endl;
+        tracePath.clear();
+#endif
+    }
+    // Writes the trace when main returns, on error paths as well, so that a
+    // failing run can be looked at too.
+    struct TraceWriter
+    {
+        const std::string& path;
+        ~TraceWriter()
+        {
+#if defined(CGLAB_TRACE)
+            if (path.empty())
+                return;
+            Trace::stop();
+            std::ofstream file(path, std::ios::binary);
+            Trace::writeChromeTrace(file);
+            Trace::writeSummary(std::cerr);
+#endif
+        }
+    } traceWriter{ tracePath };
+
+    if (!streamed.empty())
+    {
+        if (options.filters.size() != 1)
+        {
+            std::cerr << "-s takes exactly one filter spec" << std::endl;
+            return 1;
+        }
+        // The image is only ever seen a strip at a time, so there is nothing to
+        // build a filter that measures it from.
+        if (options.filters[0].dependsOnImage())
+        {
+            std::cerr << "-s cannot run " << options.filters[0].label() << ": it needs the whole image" << std::endl;
+            return 1;
+        }
+        try
+        {
+            std::unique_ptr<Filter> filter = options.filters[0].build(QImage(), options.structure);
+            StripProcessor(*filter, stripRows).run(s, streamed);
+        }
+        catch (const std::exception& error)
+        {
+            std::cerr << error.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
 
-    Grad grad(MatKernel);
-    grad.process(img).save("C:/Users/Admin/source/repos/filters-lab/filters-lab/Images/Gradient.png");
+    if (video)
+    {
+        if (options.filters.size() != 1)
+        {
+            std::cerr << "-v takes exactly one filter spec" << std::endl;
+            return 1;
+        }
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        std::ios::sync_with_stdio(false);
+        try
+        {
+            int frames = FrameStream(options.filters[0], options.structure).run(std::cin, std::cout);
+            std::cerr << frames << " frames" << std::endl;
+        }
+        catch (const std::exception& error)
+        {
+            std::cerr << error.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
 
-    Median med;
-    med.process(img).save("C:/Users/Admin/source/repos/filters-lab/filters-lab/Images/Median.png");
+    if (!dir.empty())
+    {
+        options.inputRoot = std::filesystem::u8path(dir);
+        options.inputs = scanDirectory(options.inputRoot);
+    }
+    else if (!manifest.empty())
+    {
+        options.inputRoot = std::filesystem::u8path(manifest).parent_path();
+        if (options.inputRoot.empty())
+            options.inputRoot = ".";
+        options.inputs = readManifest(std::filesystem::u8path(manifest));
+    }
+    else
+        options.inputs.push_back(std::filesystem::u8path(s));
 
-    MotionBlur motblur;
-    motblur.process(img).save("Images/MotionBlur.png");
+    BatchReport report = runBatch(options);
+    std::cout << report.images << " images, " << report.written << " outputs written, " << report.failed << " failures" << std::endl;
 
-    return 0;
+    return report.failed == 0 ? 0 : 1;
 
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,440 @@
+#include "morphology.h"
+#include "imagepool.h"
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+namespace
+{
+	// Byte array on image pool storage, kept until it has to grow. Resizing
+	// does not preserve the contents.
+	class PooledBytes
+	{
+		ImagePool::Buffer buffer;
+		std::size_t length = 0, capacity = 0;
+	public:
+		void resize(std::size_t bytes)
+		{
+			if (bytes > capacity)
+			{
+				buffer = ImagePool::shared().buffer(bytes);
+				capacity = bytes;
+			}
+			length = bytes;
+		}
+		std::size_t size() const
+		{
+			return length;
+		}
+		uchar* data() const
+		{
+			return buffer.as<uchar>();
+		}
+		uchar& operator[](std::size_t i) const
+		{
+			return data()[i];
+		}
+	};
+
+	struct MaxOp
+	{
+		uchar operator()(uchar a, uchar b) const
+		{
+			return a > b ? a : b;
+		}
+	};
+
+	struct MinOp
+	{
+		uchar operator()(uchar a, uchar b) const
+		{
+			return a < b ? a : b;
+		}
+	};
+
+	// van Herk/Gil-Werman: out[x] = op(in[x .. x + k - 1]) for x in [0, count - k].
+	// Elements are width bytes wide and reduced byte by byte. The input is cut
+	// into blocks of k. forward and backward hold running extrema inside each
+	// block, from the left and from the right, so every window is one
+	// combination of the two.
+	template <class Op>
+	void slidingExtremum(const uchar* in, uchar* out, int count, int k, int width,
+		PooledBytes& forward, PooledBytes& backward, Op op)
+	{
+		forward.resize(std::size_t(count) * width);
+		backward.resize(forward.size());
+		for (int i = 0; i < count; i++)
+		{
+			const uchar* src = in + std::size_t(i) * width;
+			uchar* f = &forward[std::size_t(i) * width];
+			if (i % k == 0)
+				std::memcpy(f, src, width);
+			else
+				for (int b = 0; b < width; b++)
+					f[b] = op(f[b - width], src[b]);
+		}
+		for (int i = count - 1; i >= 0; i--)
+		{
+			const uchar* src = in + std::size_t(i) * width;
+			uchar* g = &backward[std::size_t(i) * width];
+			if (i % k == k - 1 || i == count - 1)
+				std::memcpy(g, src, width);
+			else
+				for (int b = 0; b < width; b++)
+					g[b] = op(g[b + width], src[b]);
+		}
+		for (int x = 0; x + k <= count; x++)
+		{
+			const uchar* g = &backward[std::size_t(x) * width];
+			const uchar* f = &forward[std::size_t(x + k - 1) * width];
+			uchar* o = out + std::size_t(x) * width;
+			for (int b = 0; b < width; b++)
+				o[b] = op(g[b], f[b]);
+		}
+	}
+
+	struct NoOp
+	{
+	};
+
+	struct Scratch
+	{
+		PooledBytes line, horizontal[2], pass[2], forward, backward;
+	};
+
+	template <class Op>
+	void combine(uchar* to, const uchar* from, std::size_t bytes, Op op)
+	{
+		for (std::size_t n = 0; n < bytes; n++)
+			to[n] = op(to[n], from[n]);
+	}
+
+	// Rows [begin, end) of the op-extremum over the union of rects into outA,
+	// and, unless OpB is NoOp, of a second op into outB from the same sweep:
+	// every source row is loaded and padded once for both.
+	template <class OpA, class OpB>
+	void extremumRows(const BorderedView& src, int begin, int end, const std::vector<MorphRect>& rects,
+		OpA opA, uchar* outA, qsizetype strideA, OpB opB, uchar* outB, qsizetype strideB, Scratch& scratch)
+	{
+		constexpr bool both = !std::is_same<OpB, NoOp>::value;
+		int w = src.width();
+		std::size_t rowBytes = 4 * std::size_t(w);
+		int rows = end - begin;
+
+		for (std::size_t r = 0; r < rects.size(); r++)
+		{
+			const MorphRect& rect = rects[r];
+			int kx = rect.right - rect.left + 1, ky = rect.bottom - rect.top + 1;
+			int count = rows + ky - 1;
+
+			scratch.line.resize(std::size_t(w + kx - 1) * 4);
+			for (int k = 0; k < (both ? 2 : 1); k++)
+			{
+				scratch.horizontal[k].resize(std::size_t(count) * rowBytes);
+				scratch.pass[k].resize(std::size_t(rows) * rowBytes);
+			}
+			for (int t = 0; t < count; t++)
+			{
+				src.fill(begin + rect.top + t, rect.left, w + rect.right, reinterpret_cast<QRgb*>(scratch.line.data()));
+				slidingExtremum(scratch.line.data(), &scratch.horizontal[0][t * rowBytes], w + kx - 1, kx, 4, scratch.forward, scratch.backward, opA);
+				if constexpr (both)
+					slidingExtremum(scratch.line.data(), &scratch.horizontal[1][t * rowBytes], w + kx - 1, kx, 4, scratch.forward, scratch.backward, opB);
+			}
+
+			slidingExtremum(scratch.horizontal[0].data(), scratch.pass[0].data(), count, ky, int(rowBytes), scratch.forward, scratch.backward, opA);
+			if constexpr (both)
+				slidingExtremum(scratch.horizontal[1].data(), scratch.pass[1].data(), count, ky, int(rowBytes), scratch.forward, scratch.backward, opB);
+			for (int y = 0; y < rows; y++)
+			{
+				uchar* a = outA + y * strideA;
+				const uchar* pa = &scratch.pass[0][y * rowBytes];
+				if (r == 0)
+					std::memcpy(a, pa, rowBytes);
+				else
+					combine(a, pa, rowBytes, opA);
+				if constexpr (both)
+				{
+					uchar* b = outB + y * strideB;
+					const uchar* pb = &scratch.pass[1][y * rowBytes];
+					if (r == 0)
+						std::memcpy(b, pb, rowBytes);
+					else
+						combine(b, pb, rowBytes, opB);
+				}
+			}
+		}
+	}
+
+	// Rows per chunk: the vertical passes keep chunk + ky - 1 rows in flight,
+	// so memory stays O(radius) rows whatever the band height.
+	int chunkRows(const std::vector<MorphRect>& rects)
+	{
+		int tallest = 1;
+		for (const MorphRect& rect : rects)
+			tallest = std::max(tallest, rect.bottom - rect.top + 1);
+		return std::max(32, 4 * tallest);
+	}
+
+	// Morphology operators over floats, for the weighted path.
+	struct Greater
+	{
+		bool operator()(float a, float b) const
+		{
+			return a > b;
+		}
+	};
+
+	struct Less
+	{
+		bool operator()(float a, float b) const
+		{
+			return a < b;
+		}
+	};
+
+	inline int toChannel(float value)
+	{
+		if (value > 255.f)
+			return 255;
+		if (value < 0.f)
+			return 0;
+		return int(value);
+	}
+
+	template <class Better>
+	void weighted(const PixelView& src, const PixelSpan& dst, int begin, int end, const float* kernel, int radius,
+		const Border& border, float start, Better better)
+	{
+		// Zero taps of a flat kernel only matter to erosion, where they
+		// would pull every pixel to 0; skipping them is harmless for dilation.
+		bool skipZero = isFlatKernel(kernel, radius);
+		int w = src.width();
+		int size = 2 * radius + 1;
+		int rowPixels = w + 2 * radius;
+		BorderedView rows(src, border);
+		ImagePool::Buffer ringBuffer = ImagePool::shared().buffer(sizeof(QRgb) * rowPixels * size);
+		QRgb* ring = ringBuffer.as<QRgb>();
+		auto slot = [&](int y)
+		{
+			return &ring[rowPixels * (((y % size) + size) % size)];
+		};
+		ImagePool::Buffer tapBuffer = ImagePool::shared().buffer(sizeof(const QRgb*) * size);
+		const QRgb** taps = tapBuffer.as<const QRgb*>();
+
+		for (int y = begin - radius; y < begin + radius; y++)
+			rows.fill(y, -radius, w + radius, slot(y));
+		for (int y = begin; y < end; y++)
+		{
+			rows.fill(y + radius, -radius, w + radius, slot(y + radius));
+			for (int i = 0; i < size; i++)
+				taps[i] = slot(y - radius + i);
+			QRgb* out = dst.row(y);
+			for (int x = 0; x < w; x++)
+			{
+				float r = start, g = start, b = start;
+				for (int i = 0; i < size; i++)
+				{
+					const QRgb* row = taps[i] + x;
+					const float* k = kernel + i * size;
+					for (int j = 0; j < size; j++)
+					{
+						if (skipZero && k[j] == 0.f)
+							continue;
+						float tr = qRed(row[j]) * k[j], tg = qGreen(row[j]) * k[j], tb = qBlue(row[j]) * k[j];
+						if (better(tr, r))
+							r = tr;
+						if (better(tg, g))
+							g = tg;
+						if (better(tb, b))
+							b = tb;
+					}
+				}
+				out[x] = qRgb(toChannel(r), toChannel(g), toChannel(b));
+			}
+		}
+	}
+
+	void opaque(const PixelSpan& dst, int begin, int end)
+	{
+		for (int y = begin; y < end; y++)
+		{
+			QRgb* out = dst.row(y);
+			for (int x = 0; x < dst.width(); x++)
+				out[x] |= 0xff000000u;
+		}
+	}
+
+	template <class Op>
+	void single(const PixelView& src, const PixelSpan& dst, int begin, int end, const std::vector<MorphRect>& rects,
+		const Border& border, Op op)
+	{
+		Scratch scratch;
+		BorderedView rows(src, border);
+		int chunk = chunkRows(rects);
+		for (int y0 = begin; y0 < end; y0 += chunk)
+		{
+			int y1 = std::min(end, y0 + chunk);
+			extremumRows(rows, y0, y1, rects, op, reinterpret_cast<uchar*>(dst.row(y0)), dst.bytesPerLine(), NoOp(), nullptr, 0, scratch);
+		}
+		opaque(dst, begin, end);
+	}
+
+	template <class First, class Second>
+	void chain(const PixelView& src, const PixelSpan& dst, int begin, int end, const std::vector<MorphRect>& rects,
+		const Border& border, First first, Second second)
+	{
+		Scratch scratch;
+		BorderedView rows(src, border);
+		int w = src.width(), h = src.height();
+		qsizetype rowBytes = 4 * qsizetype(w);
+		int above = 0, below = 0;
+		for (const MorphRect& rect : rects)
+		{
+			above = std::max(above, -rect.top);
+			below = std::max(below, rect.bottom);
+		}
+		int chunk = chunkRows(rects);
+		// The first result of a wrapped source is periodic too, so the window
+		// holds it unclipped and the second op reads it without a vertical border.
+		bool periodic = border.mode == BorderMode::Wrap;
+		PooledBytes middle;
+		for (int y0 = begin; y0 < end; y0 += chunk)
+		{
+			int y1 = std::min(end, y0 + chunk);
+			// Rows of the first result the second op reads. Clamp and Mirror
+			// map rows past the image edges no farther in than the edge's own
+			// distance, and the window reaches the edge there too.
+			int top = y0 - above, bottom = y1 + below;
+			if (!periodic)
+			{
+				top = std::max(0, top);
+				bottom = std::min(h, bottom);
+			}
+			middle.resize(std::size_t(bottom - top) * rowBytes);
+			extremumRows(rows, top, bottom, rects, first, middle.data(), rowBytes, NoOp(), nullptr, 0, scratch);
+			int shift = periodic ? top : 0;
+			BorderedView inner(middle.data(), rowBytes, top - shift, w, periodic ? bottom - top : h, border);
+			extremumRows(inner, y0 - shift, y1 - shift, rects, second, reinterpret_cast<uchar*>(dst.row(y0)), dst.bytesPerLine(), NoOp(), nullptr, 0, scratch);
+		}
+		opaque(dst, begin, end);
+	}
+}
+
+std::vector<MorphRect> squareElement(int radius)
+{
+	return std::vector<MorphRect>(1, MorphRect{ -radius, -radius, radius, radius });
+}
+
+bool isFlatKernel(const float* kernel, int radius)
+{
+	int size = 2 * radius + 1;
+	bool any = false;
+	for (int i = 0; i < size * size; i++)
+	{
+		if (kernel[i] != 0.f && kernel[i] != 1.f)
+			return false;
+		any = any || kernel[i] == 1.f;
+	}
+	return any;
+}
+
+std::vector<MorphRect> decomposeFlatKernel(const float* kernel, int radius)
+{
+	int size = 2 * radius + 1;
+	std::vector<MorphRect> rects;
+	if (!isFlatKernel(kernel, radius))
+		return rects;
+
+	auto set = [&](int i, int j)
+	{
+		return kernel[(i + radius) * size + j + radius] == 1.f;
+	};
+	std::vector<bool> covered(size * size, false);
+	for (int i = -radius; i <= radius; i++)
+		for (int j = -radius; j <= radius; j++)
+		{
+			if (!set(i, j) || covered[(i + radius) * size + j + radius])
+				continue;
+			// Grow the widest run through (i, j), then extend it up and down
+			// while the rows above and below cover the whole run. Taps that
+			// are already covered may be covered again.
+			MorphRect rect = { i, j, i, j };
+			while (rect.left > -radius && set(i, rect.left - 1))
+				rect.left--;
+			while (rect.right < radius && set(i, rect.right + 1))
+				rect.right++;
+			auto fullRow = [&](int row)
+			{
+				for (int c = rect.left; c <= rect.right; c++)
+					if (!set(row, c))
+						return false;
+				return true;
+			};
+			while (rect.top > -radius && fullRow(rect.top - 1))
+				rect.top--;
+			while (rect.bottom < radius && fullRow(rect.bottom + 1))
+				rect.bottom++;
+			for (int a = rect.top; a <= rect.bottom; a++)
+				for (int b = rect.left; b <= rect.right; b++)
+					covered[(a + radius) * size + b + radius] = true;
+			rects.push_back(rect);
+			if (int(rects.size()) > size)
+			{
+				rects.clear();
+				return rects;
+			}
+		}
+	return rects;
+}
+
+void morphology(const PixelView& src, const PixelSpan& dst, int begin, int end,
+	const std::vector<MorphRect>& rects, MorphOp op, const Border& border)
+{
+	if (op == MorphOp::Dilate)
+		single(src, dst, begin, end, rects, border, MaxOp());
+	else
+		single(src, dst, begin, end, rects, border, MinOp());
+}
+
+void weightedMorphology(const PixelView& src, const PixelSpan& dst, int begin, int end,
+	const float* kernel, int radius, MorphOp op, const Border& border)
+{
+	if (op == MorphOp::Dilate)
+		weighted(src, dst, begin, end, kernel, radius, border, 0.f, Greater());
+	else
+		weighted(src, dst, begin, end, kernel, radius, border, 255.f, Less());
+}
+
+void morphologyChain(const PixelView& src, const PixelSpan& dst, int begin, int end,
+	const std::vector<MorphRect>& rects, MorphOp first, const Border& border)
+{
+	if (first == MorphOp::Dilate)
+		chain(src, dst, begin, end, rects, border, MaxOp(), MinOp());
+	else
+		chain(src, dst, begin, end, rects, border, MinOp(), MaxOp());
+}
+
+void morphologyGradient(const PixelView& src, const PixelSpan& dst, int begin, int end,
+	const std::vector<MorphRect>& rects, const Border& border)
+{
+	Scratch scratch;
+	BorderedView rows(src, border);
+	int chunk = chunkRows(rects);
+	std::size_t rowBytes = 4 * std::size_t(src.width());
+	ImagePool::Buffer lowBuffer = ImagePool::shared().buffer(chunk * rowBytes);
+	uchar* lows = lowBuffer.as<uchar>();
+	for (int y0 = begin; y0 < end; y0 += chunk)
+	{
+		int y1 = std::min(end, y0 + chunk);
+		// Max goes straight to the output, min to a chunk buffer.
+		extremumRows(rows, y0, y1, rects, MaxOp(), reinterpret_cast<uchar*>(dst.row(y0)), dst.bytesPerLine(), MinOp(), lows, rowBytes, scratch);
+		for (int y = y0; y < y1; y++)
+		{
+			uchar* out = reinterpret_cast<uchar*>(dst.row(y));
+			const uchar* low = &lows[(y - y0) * rowBytes];
+			for (std::size_t n = 0; n < rowBytes; n++)
+				out[n] -= low[n];
+		}
+	}
+	opaque(dst, begin, end);
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "border.h"
+#include <vector>
+
+enum class MorphOp
+{
+	Dilate,
+	Erode
+};
+
+// Rectangle of a structuring element, as inclusive offsets from the centre.
+struct MorphRect
+{
+	int top, left, bottom, right;
+};
+
+// True if every weight is 0 or 1 and at least one is 1. The 0 taps of such a
+// kernel are outside the structuring element: every path skips them.
+bool isFlatKernel(const float* kernel, int radius);
+// Covers the taps of a flat kernel (every weight 0 or 1) with rectangles,
+// which may overlap. Returns an empty list for weighted kernels, or when
+// the shape needs more than 2r+1 rectangles to cover.
+std::vector<MorphRect> decomposeFlatKernel(const float* kernel, int radius);
+// The full (2r+1)^2 square as a single rectangle.
+std::vector<MorphRect> squareElement(int radius);
+
+// Per-channel max (Dilate) or min (Erode) over the union of rects for output
+// rows [begin, end), the source extended by border. Each rectangle is one
+// horizontal and one vertical van Herk/Gil-Werman pass. A pass costs about
+// 3 comparisons per byte for any rectangle size.
+void morphology(const PixelView& src, const PixelSpan& dst, int begin, int end,
+	const std::vector<MorphRect>& rects, MorphOp op, const Border& border = Border());
+
+// Max (Dilate) or min (Erode) of the per-channel products with a weighted
+// kernel, for kernels decomposeFlatKernel rejects. Every tap counts, zero
+// weights included, except for flat kernels whose shape needs too many
+// rectangles: those skip their 0 taps, as morphology() does. Dilation starts
+// from 0 and erosion from 255, and the result is truncated, as in the
+// per-pixel loop. Source rows are padded once
+// per band, so the taps are read without mapping.
+void weightedMorphology(const PixelView& src, const PixelSpan& dst, int begin, int end,
+	const float* kernel, int radius, MorphOp op, const Border& border = Border());
+
+// first followed by the opposite op over the same rects (Dilate then Erode,
+// or the reverse). The band is cut into chunks of rows, and each chunk
+// computes only the intermediate rows the second op needs. Neither op
+// materialises a full intermediate image.
+void morphologyChain(const PixelView& src, const PixelSpan& dst, int begin, int end,
+	const std::vector<MorphRect>& rects, MorphOp first, const Border& border = Border());
+
+// Morphological gradient, max minus min over rects, in a single sweep:
+// every source row is read once for both extrema.
+void morphologyGradient(const PixelView& src, const PixelSpan& dst, int begin, int end,
+	const std::vector<MorphRect>& rects, const Border& border = Border());
@@ -0,0 +1,219 @@
+#include "netpbm.h"
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// Next token of a P5/P6 header, skipping whitespace and comments.
+	std::string token(std::istream& in)
+	{
+		std::string word;
+		int c = in.get();
+		while (c != EOF && (std::isspace(c) || c == '#'))
+		{
+			if (c == '#')
+				while (c != EOF && c != '\n')
+					c = in.get();
+			c = in.get();
+		}
+		while (c != EOF && !std::isspace(c))
+		{
+			word += char(c);
+			c = in.get();
+		}
+		// The single whitespace after the last header token has been consumed.
+		return word;
+	}
+
+	int number(const std::string& word)
+	{
+		std::size_t used = 0;
+		int value = 0;
+		try
+		{
+			value = std::stoi(word, &used);
+		}
+		catch (const std::exception&)
+		{
+			used = 0;
+		}
+		if (used == 0 || used != word.size() || value < 0)
+			throw std::runtime_error("bad Netpbm header field '" + word + "'");
+		return value;
+	}
+}
+
+NetpbmHeader NetpbmHeader::read(std::istream& in)
+{
+	std::streampos start = in.tellg();
+	NetpbmHeader head;
+	int maxval = 0;
+	std::string magic = token(in);
+	if (magic == "P5" || magic == "P6")
+	{
+		head.channels = magic == "P5" ? 1 : 3;
+		head.width = number(token(in));
+		head.height = number(token(in));
+		maxval = number(token(in));
+	}
+	else if (magic == "P7")
+	{
+		std::string line;
+		while (std::getline(in, line) && line != "ENDHDR")
+		{
+			std::size_t space = line.find(' ');
+			std::string key = line.substr(0, space);
+			std::size_t first = space == std::string::npos ? space : line.find_first_not_of(' ', space);
+			std::string value = first == std::string::npos ? "" : line.substr(first);
+			if (key == "WIDTH")
+				head.width = number(value);
+			else if (key == "HEIGHT")
+				head.height = number(value);
+			else if (key == "DEPTH")
+				head.channels = number(value);
+			else if (key == "MAXVAL")
+				maxval = number(value);
+		}
+		if (!in)
+			throw std::runtime_error("PAM header without ENDHDR");
+	}
+	else
+		throw std::runtime_error("not a PGM, PPM or PAM image");
+
+	if (maxval != 255)
+		throw std::runtime_error("only 8-bit Netpbm images are supported");
+	if (head.channels != 1 && head.channels != 3 && head.channels != 4)
+		throw std::runtime_error("unsupported PAM depth " + std::to_string(head.channels));
+	if (!in)
+		throw std::runtime_error("truncated Netpbm header");
+	if (start != std::streampos(-1))
+		head.size = std::size_t(in.tellg() - start);
+	return head;
+}
+
+void NetpbmHeader::write(std::ostream& out) const
+{
+	if (channels == 4)
+		out << "P7\nWIDTH " << width << "\nHEIGHT " << height << "\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n";
+	else
+		out << (channels == 1 ? "P5\n" : "P6\n") << width << " " << height << "\n255\n";
+}
+
+void unpackRow(const uchar* samples, int width, int channels, QRgb* out)
+{
+	switch (channels)
+	{
+	case 1:
+		for (int x = 0; x < width; x++)
+			out[x] = qRgb(samples[x], samples[x], samples[x]);
+		break;
+	case 3:
+		for (int x = 0; x < width; x++, samples += 3)
+			out[x] = qRgb(samples[0], samples[1], samples[2]);
+		break;
+	default:
+		for (int x = 0; x < width; x++, samples += 4)
+			out[x] = qRgba(samples[0], samples[1], samples[2], samples[3]);
+		break;
+	}
+}
+
+void packRow(const QRgb* pixels, int width, int channels, uchar* out)
+{
+	if (channels == 1)
+	{
+		for (int x = 0; x < width; x++)
+			out[x] = uchar(qGray(pixels[x]));
+		return;
+	}
+	for (int x = 0; x < width; x++)
+	{
+		*out++ = uchar(qRed(pixels[x]));
+		*out++ = uchar(qGreen(pixels[x]));
+		*out++ = uchar(qBlue(pixels[x]));
+		if (channels == 4)
+			*out++ = uchar(qAlpha(pixels[x]));
+	}
+}
+
+MappedImage::MappedImage(const std::string& path)
+{
+	std::filesystem::path file = std::filesystem::u8path(path);
+	{
+		std::ifstream in(file, std::ios::binary);
+		if (!in)
+			throw std::runtime_error("cannot open " + path);
+		head = NetpbmHeader::read(in);
+	}
+	std::size_t expected = head.size + head.rowBytes() * head.height;
+
+#ifdef _WIN32
+	this->file = CreateFileW(file.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (this->file == INVALID_HANDLE_VALUE)
+	{
+		this->file = nullptr;
+		throw std::runtime_error("cannot open " + path);
+	}
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(this->file, &fileSize);
+	length = std::size_t(fileSize.QuadPart);
+	if (length >= expected)
+		mapping = CreateFileMappingW(this->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping)
+		data = static_cast<const uchar*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!data)
+	{
+		if (mapping)
+			CloseHandle(mapping);
+		CloseHandle(this->file);
+		mapping = this->file = nullptr;
+		throw std::runtime_error(length < expected ? "truncated image " + path : "cannot map " + path);
+	}
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("cannot open " + path);
+	struct stat info;
+	fstat(fd, &info);
+	length = std::size_t(info.st_size);
+	void* mapped = length >= expected ? mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (mapped == MAP_FAILED)
+		throw std::runtime_error(length < expected ? "truncated image " + path : "cannot map " + path);
+	data = static_cast<const uchar*>(mapped);
+	posix_madvise(mapped, length, POSIX_MADV_SEQUENTIAL);
+#endif
+}
+
+MappedImage::~MappedImage()
+{
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+	CloseHandle(mapping);
+	CloseHandle(file);
+#else
+	munmap(const_cast<uchar*>(data), length);
+#endif
+}
+
+void MappedImage::release(int end) const
+{
+#ifndef _WIN32
+	// Whole pages only; the page holding row end stays mapped.
+	std::size_t page = std::size_t(sysconf(_SC_PAGESIZE));
+	std::size_t bytes = (head.size + head.rowBytes() * end) / page * page;
+	if (bytes > 0)
+		posix_madvise(const_cast<uchar*>(data), bytes, POSIX_MADV_DONTNEED);
+#endif
+}
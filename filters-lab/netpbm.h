@@ -0,0 +1,59 @@
+#pragma once
+#include "pixelview.h"
+#include <istream>
+#include <ostream>
+#include <string>
+
+// 8-bit Netpbm images: PGM (P5), PPM (P6) and PAM (P7) with 1, 3 or 4 channels.
+struct NetpbmHeader
+{
+	int width = 0, height = 0;
+	int channels = 3;
+	// Bytes before the first row.
+	std::size_t size = 0;
+
+	std::size_t rowBytes() const
+	{
+		return std::size_t(width) * channels;
+	}
+	// Reads a header and leaves in at the first row. Throws std::runtime_error.
+	static NetpbmHeader read(std::istream& in);
+	// Writes a PAM header for channels == 4, a PGM header for 1 and a PPM header otherwise.
+	void write(std::ostream& out) const;
+};
+
+// Converts a row of samples to opaque (or, with 4 channels, straight-alpha) QRgb.
+void unpackRow(const uchar* samples, int width, int channels, QRgb* out);
+// Converts QRgb to 1 (grey), 3 or 4 samples per pixel.
+void packRow(const QRgb* pixels, int width, int channels, uchar* out);
+
+// Read-only memory mapping of a whole Netpbm file. Rows are paged in on access,
+// so only the rows being read count against memory.
+class MappedImage
+{
+public:
+	// Throws std::runtime_error if the file cannot be opened or parsed.
+	explicit MappedImage(const std::string& path);
+	~MappedImage();
+	MappedImage(const MappedImage&) = delete;
+	MappedImage& operator=(const MappedImage&) = delete;
+
+	const NetpbmHeader& header() const
+	{
+		return head;
+	}
+	const uchar* row(int y) const
+	{
+		return data + head.size + std::size_t(y) * head.rowBytes();
+	}
+	// Lets the system drop the pages of rows [0, end), which will not be read again.
+	void release(int end) const;
+private:
+	NetpbmHeader head;
+	const uchar* data = nullptr;
+	std::size_t length = 0;
+#ifdef _WIN32
+	void* file = nullptr;
+	void* mapping = nullptr;
+#endif
+};
@@ -0,0 +1,169 @@
+#include "pipeline.h"
+
+// A filter, or a run of point filters fused into one table.
+struct Pipeline::Step
+{
+	std::function<void(const PixelView&, const PixelSpan&, int, int)> run;
+	int halo;
+	std::shared_ptr<PointLut> table;
+};
+
+std::vector<Pipeline::Step> Pipeline::plan(std::size_t first, std::size_t last) const
+{
+	std::vector<Step> steps;
+	for (std::size_t i = first; i < last; i++)
+	{
+		const Filter* stage = stages[i];
+		const PointFilter* point = dynamic_cast<const PointFilter*>(stage);
+		if (!point)
+		{
+			steps.push_back({ [stage](const PixelView& src, const PixelSpan& dst, int begin, int end)
+			{
+				stage->processRows(src, dst, begin, end);
+			}, stage->halo(), nullptr });
+			continue;
+		}
+
+		PointLut table = point->compile(ChannelHistograms());
+		if (!steps.empty() && steps.back().table)
+		{
+			*steps.back().table = steps.back().table->then(table);
+			continue;
+		}
+		std::shared_ptr<PointLut> fused = std::make_shared<PointLut>(table);
+		steps.push_back({ [fused](const PixelView& src, const PixelSpan& dst, int begin, int end)
+		{
+			fused->apply(src, dst, begin, end);
+		}, 0, fused });
+	}
+	return steps;
+}
+
+Pipeline::Plan Pipeline::cachedPlan(std::size_t first, std::size_t last) const
+{
+	std::lock_guard<std::mutex> guard(planLock);
+	Plan& steps = plans[std::make_pair(first, last)];
+	if (!steps)
+		steps = std::make_shared<const std::vector<Step>>(plan(first, last));
+	return steps;
+}
+
+void Pipeline::runStrips(const std::vector<Step>& steps, const PixelView& src, const PixelSpan& dst, int begin, int end)
+{
+	if (steps.size() == 1)
+	{
+		steps[0].run(src, dst, begin, end);
+		return;
+	}
+
+	// Rows beyond a strip that step k has to produce for the steps after it.
+	ImagePool::Buffer reachBuffer = ImagePool::shared().buffer(sizeof(int) * steps.size());
+	int* reach = reachBuffer.as<int>();
+	reach[steps.size() - 1] = 0;
+	for (int k = int(steps.size()) - 2; k >= 0; k--)
+		reach[k] = reach[k + 1] + steps[k + 1].halo;
+
+	// Two windows of strip + 2 * reach rows fit the budget, but a strip stays
+	// well above the rows it recomputes for its neighbours.
+	qsizetype rowBytes = std::max<qsizetype>(qsizetype(src.width()) * 4, 1);
+	int strip = int(StripBytes / (2 * rowBytes)) - 2 * reach[0];
+	strip = std::min(std::max({ strip, 4 * reach[0], 16 }), end - begin);
+
+	QImage windows[2];
+	for (QImage& window : windows)
+		window = ImagePool::shared().image(src.width(), strip + 2 * reach[0], QImage::Format_ARGB32);
+
+	int h = src.height();
+	for (int y0 = begin; y0 < end; y0 += strip)
+	{
+		int y1 = std::min(y0 + strip, end);
+		PixelView in = src;
+		for (std::size_t k = 0; k + 1 < steps.size(); k++)
+		{
+			int top = std::max(0, y0 - reach[k]);
+			int bottom = std::min(h, y1 + reach[k]);
+			QImage& window = windows[k % 2];
+			steps[k].run(in, PixelSpan(window, top, h), top, bottom);
+			in = PixelView(window, top, h);
+		}
+		steps.back().run(in, dst, y0, y1);
+	}
+}
+
+QImage Pipeline::runSegment(const QImage& img, std::size_t first, std::size_t last) const
+{
+	if (first == last)
+		return img;
+	if (last - first == 1)
+		return stages[first]->process(img);
+
+	Plan steps = cachedPlan(first, last);
+	int total = 0;
+	for (const Step& step : *steps)
+		total += step.halo;
+
+	QImage result = ImagePool::shared().image(img.size(), img.format());
+	PixelView src(img);
+	PixelSpan dst(result);
+	forEachBand(img.height(), [&](int begin, int end)
+	{
+		runStrips(*steps, src, dst, begin, end);
+	}, total);
+	return result;
+}
+
+void Pipeline::processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const
+{
+	Plan steps = cachedPlan(0, stages.size());
+	if (steps->empty())
+	{
+		for (int y = begin; y < end; y++)
+			std::copy(src.row(y), src.row(y) + src.width(), dst.row(y));
+		return;
+	}
+	runStrips(*steps, src, dst, begin, end);
+}
+
+QImage Pipeline::process(const QImage& img) const
+{
+	CGLAB_TRACE_PROCESS(img);
+	if (!PixelView::isSupported(img.format()))
+		return process(img.convertToFormat(QImage::Format_ARGB32)).convertToFormat(img.format());
+
+	QImage current = img;
+	std::size_t first = 0;
+	for (std::size_t i = 0; i <= stages.size(); i++)
+	{
+		if (i < stages.size() && stages[i]->isLocal())
+			continue;
+		current = runSegment(current, first, i);
+		if (i < stages.size())
+			current = stages[i]->process(current);
+		first = i + 1;
+	}
+	return current;
+}
+
+int Pipeline::halo() const
+{
+	int total = 0;
+	for (const Filter* stage : stages)
+		total += stage->halo();
+	return total;
+}
+
+bool Pipeline::isLocal() const
+{
+	for (const Filter* stage : stages)
+		if (!stage->isLocal())
+			return false;
+	return true;
+}
+
+bool Pipeline::dependsOnPosition() const
+{
+	for (const Filter* stage : stages)
+		if (stage->dependsOnPosition())
+			return true;
+	return false;
+}
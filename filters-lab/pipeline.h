@@ -0,0 +1,51 @@
+#pragma once
+#include "filter.h"
+#include <map>
+#include <mutex>
+
+// Lazily recorded chain of filters. Instead of materialising every stage as a
+// full image, process() computes each band of output rows in strips: a strip
+// runs through all stages, with every intermediate held in a small window of
+// rows (the strip plus the halos of the later stages) that stays in cache.
+// Consecutive point filters are fused into one table. A stage that needs
+// whole-image statistics or a wrapped border (isLocal() == false) splits the chain, and the part
+// before it is materialised. Stages are not owned and must outlive the pipeline.
+class Pipeline : public Filter
+{
+protected:
+	std::vector<const Filter*> stages;
+	// process() converts other formats to ARGB32 and processRows() runs the
+	// stages, so nothing reaches the per-pixel path.
+	QColor calcNewPixelColor(const QImage& img, int x, int y) const override
+	{
+		throw std::logic_error("Pipeline has no per-pixel path");
+	}
+	void processRows(const PixelView& src, const PixelSpan& dst, int begin, int end) const override;
+
+	struct Step;
+	using Plan = std::shared_ptr<const std::vector<Step>>;
+	// Plans by stage range, made on first use and shared by every band and
+	// call, so point tables are compiled once per pipeline; then() drops them.
+	mutable std::mutex planLock;
+	mutable std::map<std::pair<std::size_t, std::size_t>, Plan> plans;
+	// Steps for the local stages [first, last), with point filters fused.
+	std::vector<Step> plan(std::size_t first, std::size_t last) const;
+	Plan cachedPlan(std::size_t first, std::size_t last) const;
+	QImage runSegment(const QImage& img, std::size_t first, std::size_t last) const;
+	static void runStrips(const std::vector<Step>& steps, const PixelView& src, const PixelSpan& dst, int begin, int end);
+public:
+	// Bytes of intermediate rows a strip may keep per thread.
+	static const int StripBytes = 512 * 1024;
+
+	Pipeline& then(const Filter& stage)
+	{
+		std::lock_guard<std::mutex> guard(planLock);
+		stages.push_back(&stage);
+		plans.clear();
+		return *this;
+	}
+	QImage process(const QImage& img) const override;
+	int halo() const override;
+	bool isLocal() const override;
+	bool dependsOnPosition() const override;
+};
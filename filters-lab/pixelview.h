@@ -0,0 +1,102 @@
+#pragma once
+#include <QImage>
+
+// Read-only row-major view over a 32-bit QRgb image (Format_RGB32 / Format_ARGB32).
+// Rows are fetched once through constScanLine, pixels are plain QRgb words.
+class PixelView
+{
+protected:
+	const QImage* image;
+	const uchar* bits;
+	qsizetype stride;
+	int top, w, h;
+public:
+	explicit PixelView(const QImage& img) :
+		image(&img), bits(img.constBits()), stride(img.bytesPerLine()), top(0), w(img.width()), h(img.height()) {}
+	// Window holding rows [top, top + window.height()) of an image of the given
+	// height. Rows are addressed and clamped in full-image coordinates; callers
+	// only read rows the window holds. source() is the window itself.
+	PixelView(const QImage& window, int top, int height) :
+		image(&window), bits(window.constBits()), stride(window.bytesPerLine()), top(top), w(window.width()), h(height) {}
+
+	// Format_RGBA8888 is left out on purpose: its bytes are R, G, B, A in
+	// memory, so its words are not QRgb and every channel accessor would swap
+	// red and blue. Such images take the QColor path.
+	static bool isSupported(QImage::Format format)
+	{
+		return format == QImage::Format_RGB32 || format == QImage::Format_ARGB32;
+	}
+	const QImage& source() const
+	{
+		return *image;
+	}
+	int width() const
+	{
+		return w;
+	}
+	int height() const
+	{
+		return h;
+	}
+	int clampX(int x) const
+	{
+		return x < 0 ? 0 : (x >= w ? w - 1 : x);
+	}
+	int clampY(int y) const
+	{
+		return y < 0 ? 0 : (y >= h ? h - 1 : y);
+	}
+	int firstRow() const
+	{
+		return top;
+	}
+	qsizetype bytesPerLine() const
+	{
+		return stride;
+	}
+	const QRgb* row(int y) const
+	{
+		return reinterpret_cast<const QRgb*>(bits + (y - top) * stride);
+	}
+	QRgb at(int x, int y) const
+	{
+		return row(y)[x];
+	}
+	QRgb clampedAt(int x, int y) const
+	{
+		return row(clampY(y))[clampX(x)];
+	}
+};
+
+// Writable counterpart of PixelView. The image is detached once on construction,
+// so row() never triggers a copy and distinct rows may be written independently.
+class PixelSpan
+{
+protected:
+	uchar* bits;
+	qsizetype stride;
+	int top, w, h;
+public:
+	explicit PixelSpan(QImage& img) :
+		bits(img.bits()), stride(img.bytesPerLine()), top(0), w(img.width()), h(img.height()) {}
+	// Writable window, see PixelView(const QImage&, int, int).
+	PixelSpan(QImage& window, int top, int height) :
+		bits(window.bits()), stride(window.bytesPerLine()), top(top), w(window.width()), h(height) {}
+
+	int width() const
+	{
+		return w;
+	}
+	int height() const
+	{
+		return h;
+	}
+	qsizetype bytesPerLine() const
+	{
+		return stride;
+	}
+	QRgb* row(int y) const
+	{
+		return reinterpret_cast<QRgb*>(bits + (y - top) * stride);
+	}
+};
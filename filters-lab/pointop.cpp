@@ -0,0 +1,252 @@
+#include "pointop.h"
+#include "simd.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(CGLAB_X86)
+#include <immintrin.h>
+#endif
+
+void ChannelHistograms::add(const ChannelHistograms& other)
+{
+	for (int c = 0; c < 3; c++)
+		for (int v = 0; v < 256; v++)
+			counts[c][v] += other.counts[c][v];
+	pixels += other.pixels;
+}
+
+long long ChannelHistograms::sum(int c) const
+{
+	long long total = 0;
+	for (int v = 0; v < 256; v++)
+		total += counts[c][v] * v;
+	return total;
+}
+
+PointLut::PointLut()
+{
+	for (int c = 0; c < 3; c++)
+		for (int v = 0; v < 256; v++)
+			channel[c][v] = uchar(v);
+}
+
+namespace
+{
+	void channelRowsScalar(const PixelView& src, const PixelSpan& dst, int begin, int end, const uchar (*channel)[256])
+	{
+		for (int y = begin; y < end; y++)
+		{
+			const QRgb* in = src.row(y);
+			QRgb* out = dst.row(y);
+			for (int x = 0; x < src.width(); x++)
+				out[x] = qRgb(channel[0][qRed(in[x])], channel[1][qGreen(in[x])], channel[2][qBlue(in[x])]);
+		}
+	}
+
+#if defined(CGLAB_X86)
+	// Eight pixels per step: the tables are widened to words already shifted
+	// into their channel, so a pixel is three gathers ORed together.
+	CGLAB_TARGET("avx2")
+	void channelRowsAVX2(const PixelView& src, const PixelSpan& dst, int begin, int end, const uchar (*channel)[256])
+	{
+		std::uint32_t words[3][256];
+		for (int v = 0; v < 256; v++)
+		{
+			words[0][v] = 0xff000000u | std::uint32_t(channel[0][v]) << 16;
+			words[1][v] = std::uint32_t(channel[1][v]) << 8;
+			words[2][v] = channel[2][v];
+		}
+		const int* red = reinterpret_cast<const int*>(words[0]);
+		const int* green = reinterpret_cast<const int*>(words[1]);
+		const int* blue = reinterpret_cast<const int*>(words[2]);
+		const __m256i low = _mm256_set1_epi32(0xff);
+		int w = src.width();
+		for (int y = begin; y < end; y++)
+		{
+			const QRgb* in = src.row(y);
+			QRgb* out = dst.row(y);
+			int x = 0;
+			for (; x + 8 <= w; x += 8)
+			{
+				__m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + x));
+				__m256i r = _mm256_i32gather_epi32(red, _mm256_and_si256(_mm256_srli_epi32(pixels, 16), low), 4);
+				__m256i g = _mm256_i32gather_epi32(green, _mm256_and_si256(_mm256_srli_epi32(pixels, 8), low), 4);
+				__m256i b = _mm256_i32gather_epi32(blue, _mm256_and_si256(pixels, low), 4);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), _mm256_or_si256(_mm256_or_si256(r, g), b));
+			}
+			for (; x < w; x++)
+				out[x] = words[0][qRed(in[x])] | words[1][qGreen(in[x])] | words[2][qBlue(in[x])];
+		}
+	}
+#endif
+
+	// Positive doubles order like their bit patterns, so a binary search over
+	// the bits visits every representable intensity.
+	std::uint64_t bitsOf(double value)
+	{
+		std::uint64_t bits;
+		std::memcpy(&bits, &value, sizeof bits);
+		return bits;
+	}
+
+	double valueOf(std::uint64_t bits)
+	{
+		double value;
+		std::memcpy(&value, &bits, sizeof value);
+		return value;
+	}
+
+	int channelOf(QRgb color, int c)
+	{
+		return c == 0 ? qRed(color) : (c == 1 ? qGreen(color) : qBlue(color));
+	}
+}
+
+PointLut PointLut::luminance(const double weights[3], const std::function<QRgb(double)>& map)
+{
+	PointLut lut;
+	lut.mixed = true;
+	lut.mix.resize(3 * 256);
+	for (int c = 0; c < 3; c++)
+		for (int v = 0; v < 256; v++)
+			lut.mix[c * 256 + v] = weights[c] * v;
+
+	lut.post.resize(Keys);
+	lut.firstStep.assign(Keys + 1, 0);
+	for (int k = 0; k < Keys; k++)
+	{
+		double start = double(k) / KeySteps;
+		double last = std::nextafter(double(k + 1) / KeySteps, 0.0);
+		QRgb low = map(start), high = map(last);
+		lut.post[k] = low;
+
+		// The first intensity at which each changing channel takes its final value.
+		std::vector<double> edges;
+		for (int c = 0; c < 3; c++)
+		{
+			if (channelOf(low, c) == channelOf(high, c))
+				continue;
+			std::uint64_t below = bitsOf(start), above = bitsOf(last);
+			while (above - below > 1)
+			{
+				std::uint64_t middle = below + (above - below) / 2;
+				if (channelOf(map(valueOf(middle)), c) == channelOf(high, c))
+					above = middle;
+				else
+					below = middle;
+			}
+			edges.push_back(valueOf(above));
+		}
+		std::sort(edges.begin(), edges.end());
+		edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+		for (double edge : edges)
+			lut.steps.push_back({ edge, map(edge) });
+		lut.firstStep[k + 1] = int(lut.steps.size());
+	}
+	return lut;
+}
+
+PointLut PointLut::mapColors(const std::function<QRgb(QRgb)>& f) const
+{
+	PointLut result = *this;
+	result.steps.clear();
+	for (int k = 0; k < Keys; k++)
+	{
+		QRgb color = f(post[k]);
+		result.post[k] = color;
+		for (int i = firstStep[k]; i < firstStep[k + 1]; i++)
+		{
+			QRgb next = f(steps[i].color);
+			if (next != color)
+				result.steps.push_back({ steps[i].from, next });
+			color = next;
+		}
+		result.firstStep[k + 1] = int(result.steps.size());
+	}
+	return result;
+}
+
+PointLut PointLut::then(const PointLut& next) const
+{
+	if (!mixed && !next.mixed)
+	{
+		PointLut fused;
+		for (int c = 0; c < 3; c++)
+			for (int v = 0; v < 256; v++)
+				fused.channel[c][v] = next.channel[c][channel[c][v]];
+		return fused;
+	}
+	if (!mixed)
+	{
+		// Per-channel maps fold into the weights of the mix that follows.
+		PointLut fused = next;
+		for (int c = 0; c < 3; c++)
+			for (int v = 0; v < 256; v++)
+				fused.mix[c * 256 + v] = next.mix[c * 256 + channel[c][v]];
+		return fused;
+	}
+	if (!next.mixed)
+		return mapColors([&next](QRgb color)
+		{
+			return qRgb(next.channel[0][qRed(color)], next.channel[1][qGreen(color)], next.channel[2][qBlue(color)]);
+		});
+	// Within one step of this map the colour is fixed, so the second mix is too.
+	return mapColors([&next](QRgb color)
+	{
+		return next.lookup(next.mixOf(qRed(color), qGreen(color), qBlue(color)));
+	});
+}
+
+void PointLut::apply(const PixelView& src, const PixelSpan& dst, int begin, int end) const
+{
+	if (!mixed)
+	{
+#if defined(CGLAB_X86)
+		if (simdLevel() >= SimdLevel::AVX2)
+		{
+			channelRowsAVX2(src, dst, begin, end, channel);
+			return;
+		}
+#endif
+		channelRowsScalar(src, dst, begin, end, channel);
+		return;
+	}
+	for (int y = begin; y < end; y++)
+	{
+		const QRgb* in = src.row(y);
+		QRgb* out = dst.row(y);
+		for (int x = 0; x < src.width(); x++)
+			out[x] = lookup(mixOf(qRed(in[x]), qGreen(in[x]), qBlue(in[x])));
+	}
+}
+
+void PointLut::count(const PixelView& src, int begin, int end, ChannelHistograms& into) const
+{
+	for (int y = begin; y < end; y++)
+	{
+		const QRgb* in = src.row(y);
+		for (int x = 0; x < src.width(); x++)
+		{
+			int r = qRed(in[x]), g = qGreen(in[x]), b = qBlue(in[x]);
+			if (mixed)
+			{
+				QRgb color = lookup(mixOf(r, g, b));
+				r = qRed(color);
+				g = qGreen(color);
+				b = qBlue(color);
+			}
+			else
+			{
+				r = channel[0][r];
+				g = channel[1][g];
+				b = channel[2][b];
+			}
+			into.counts[0][r]++;
+			into.counts[1][g]++;
+			into.counts[2][b]++;
+		}
+	}
+	into.pixels += qint64(end - begin) * src.width();
+}
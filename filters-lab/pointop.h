@@ -0,0 +1,77 @@
+#pragma once
+#include "pixelview.h"
+#include <cmath>
+#include <functional>
+#include <vector>
+
+// Per-channel 256-bin histograms of an image (or of a mapped image).
+struct ChannelHistograms
+{
+	long long counts[3][256] = {};
+	long long pixels = 0;
+
+	void add(const ChannelHistograms& other);
+	// Sum of all values of channel c.
+	long long sum(int c) const;
+};
+
+// Compiled per-pixel colour map, in one of two forms:
+//  - per channel: out_c = channel[c][in_c];
+//  - luminance mix: I = mix[0][r] + mix[1][g] + mix[2][b] in double, and the
+//    colour is looked up by I. I is split into keys of 1 / KeySteps; each key
+//    has the colour at its start plus the exact intensities at which the colour
+//    changes inside it. The mix reproduces the filters' double intensity bit for
+//    bit, so the table is exact for any map whose channels change at most once
+//    per key, which holds for everything that steps on whole intensity levels.
+class PointLut
+{
+public:
+	static const int KeySteps = 16;
+	static const int Keys = 256 * KeySteps;
+
+	// From intensity from on (within its key) the colour is color.
+	struct Step
+	{
+		double from;
+		QRgb color;
+	};
+
+	bool mixed = false;
+	uchar channel[3][256];
+	std::vector<double> mix;
+	std::vector<QRgb> post;
+	std::vector<int> firstStep;
+	std::vector<Step> steps;
+
+	PointLut();
+	// Luminance map: weights[c] * value summed per pixel, then map(intensity).
+	static PointLut luminance(const double weights[3], const std::function<QRgb(double)>& map);
+	static int key(double intensity)
+	{
+		int k = int(std::floor(intensity * KeySteps));
+		return k < 0 ? 0 : (k >= Keys ? Keys - 1 : k);
+	}
+	double mixOf(int r, int g, int b) const
+	{
+		return mix[r] + mix[256 + g] + mix[512 + b];
+	}
+	QRgb lookup(double intensity) const
+	{
+		int k = key(intensity);
+		QRgb color = post[k];
+		for (int i = firstStep[k]; i < firstStep[k + 1] && steps[i].from <= intensity; i++)
+			color = steps[i].color;
+		return color;
+	}
+
+	// This map followed by next, as a single table.
+	PointLut then(const PointLut& next) const;
+	// The per-channel form gathers eight pixels per step on AVX2. The
+	// luminance form stays scalar: its step search branches per pixel.
+	void apply(const PixelView& src, const PixelSpan& dst, int begin, int end) const;
+	// Adds the histograms of the mapped rows [begin, end) to into.
+	void count(const PixelView& src, int begin, int end, ChannelHistograms& into) const;
+private:
+	// Same keys and steps, every colour passed through f.
+	PointLut mapColors(const std::function<QRgb(QRgb)>& f) const;
+};
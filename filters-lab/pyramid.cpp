@@ -0,0 +1,159 @@
+#include "pyramid.h"
+#include <list>
+#include <mutex>
+#include <stdexcept>
+
+namespace
+{
+	// Pyramids hold a third more than their image, so only a few are kept.
+	const std::size_t CacheEntries = 4;
+
+	struct CacheEntry
+	{
+		qint64 key;
+		std::shared_ptr<const std::vector<QImage>> reduced;
+	};
+
+	std::mutex cacheLock;
+	// Most recently used first.
+	std::list<CacheEntry> cache;
+
+	// Smooths with kernel and keeps the even rows and columns. Each output row
+	// sums its source rows into a padded line at full width, then taps the line
+	// at the even columns, so no full-size intermediate is made.
+	QImage halve(const QImage& src, const Kernel& kernel)
+	{
+		CGLAB_TRACE_SCOPE("halve", "filter");
+		int w = src.width(), h = src.height();
+		int ow = (w + 1) / 2, oh = (h + 1) / 2;
+		int r = int(kernel.getRadius());
+		const float* horizontal = kernel.horizontalFactor();
+		const float* vertical = kernel.verticalFactor();
+		QImage dst = ImagePool::shared().image(ow, oh, QImage::Format_ARGB32);
+		PixelView in(src);
+		PixelSpan out(dst);
+		ThreadPool::shared().parallelFor(0, oh, bandHeight(oh, r), [&](int begin, int end)
+		{
+			ImagePool::Buffer scratch = ImagePool::shared().buffer(sizeof(float) * 4 * (w + 2 * r));
+			float* line = scratch.as<float>();
+			for (int y = begin; y < end; y++)
+			{
+				float* sums = line + 4 * r;
+				std::fill(sums, sums + 4 * w, 0.f);
+				for (int k = -r; k <= r; k++)
+				{
+					const QRgb* row = in.row(in.clampY(2 * y + k));
+					float weight = vertical[k + r];
+					for (int x = 0; x < w; x++)
+					{
+						sums[4 * x] += weight * qRed(row[x]);
+						sums[4 * x + 1] += weight * qGreen(row[x]);
+						sums[4 * x + 2] += weight * qBlue(row[x]);
+						sums[4 * x + 3] += weight * qAlpha(row[x]);
+					}
+				}
+				for (int k = 1; k <= r; k++)
+					for (int c = 0; c < 4; c++)
+					{
+						sums[-4 * k + c] = sums[c];
+						sums[4 * (w - 1 + k) + c] = sums[4 * (w - 1) + c];
+					}
+
+				QRgb* target = out.row(y);
+				for (int x = 0; x < ow; x++)
+				{
+					float value[4] = { 0.f, 0.f, 0.f, 0.f };
+					const float* taps = sums + 4 * (2 * x - r);
+					for (int k = 0; k <= 2 * r; k++)
+						for (int c = 0; c < 4; c++)
+							value[c] += horizontal[k] * taps[4 * k + c];
+					auto channel = [&](int c)
+					{
+						return std::min(std::max(int(value[c] + 0.5f), 0), 255);
+					};
+					target[x] = qRgba(channel(0), channel(1), channel(2), channel(3));
+				}
+			}
+		});
+		return dst;
+	}
+
+	// Levels 1 and up of the pyramid of base.
+	std::vector<QImage> reduce(const QImage& base, int minSide)
+	{
+		std::vector<QImage> levels;
+		if (base.isNull())
+			return levels;
+		// sigma is the kernel's, exp(-d^2 / sigma^2): about one pixel of standard deviation.
+		GaussianKernel kernel(2, 1.5f);
+		kernel.factorize();
+		for (;;)
+		{
+			const QImage& last = levels.empty() ? base : levels.back();
+			int side = std::min(last.width(), last.height());
+			if (side < 2 || (side + 1) / 2 < minSide)
+				break;
+			levels.push_back(halve(last, kernel));
+		}
+		return levels;
+	}
+}
+
+Pyramid::Pyramid(const QImage& img, int minSide) :
+	base(PixelView::isSupported(img.format()) ? img : img.convertToFormat(QImage::Format_ARGB32)),
+	reduced(std::make_shared<const std::vector<QImage>>(reduce(base, minSide)))
+{
+}
+
+int Pyramid::levelFor(qint64 maxPixels) const
+{
+	for (int i = 0; i < levels(); i++)
+		if (qint64(level(i).width()) * level(i).height() <= maxPixels)
+			return i;
+	return levels() - 1;
+}
+
+std::shared_ptr<const Pyramid> imagePyramid(const QImage& img)
+{
+	QImage base = PixelView::isSupported(img.format()) ? img : img.convertToFormat(QImage::Format_ARGB32);
+	qint64 key = img.cacheKey();
+	{
+		std::lock_guard<std::mutex> guard(cacheLock);
+		for (auto entry = cache.begin(); entry != cache.end(); ++entry)
+			if (entry->key == key)
+			{
+				cache.splice(cache.begin(), cache, entry);
+				return std::shared_ptr<const Pyramid>(new Pyramid(base, entry->reduced));
+			}
+	}
+
+	// Built outside the lock, as in imageStats().
+	std::shared_ptr<const std::vector<QImage>> reduced = std::make_shared<const std::vector<QImage>>(reduce(base, 16));
+	std::lock_guard<std::mutex> guard(cacheLock);
+	auto entry = std::find_if(cache.begin(), cache.end(), [&](const CacheEntry& other) { return other.key == key; });
+	if (entry != cache.end())
+		reduced = entry->reduced;
+	else
+	{
+		cache.push_front({ key, reduced });
+		if (cache.size() > CacheEntries)
+			cache.pop_back();
+	}
+	return std::shared_ptr<const Pyramid>(new Pyramid(base, reduced));
+}
+
+QImage Preview::render(const FilterSpec& spec, int level) const
+{
+	CGLAB_TRACE_SCOPE("preview", "filter");
+	if (level < 0 || level >= pyramid->levels())
+		throw std::out_of_range("no pyramid level " + std::to_string(level) + " of " + std::to_string(pyramid->levels()));
+	const QImage& img = pyramid->level(level);
+	return spec.atLevel(level).build(img, structure)->process(img);
+}
+
+void Preview::refine(const FilterSpec& spec, int coarsest, const std::function<bool(const QImage& result, int level)>& show) const
+{
+	for (int level = std::min(coarsest, pyramid->levels() - 1); level >= 0; level--)
+		if (!show(render(spec, level), level))
+			return;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "filterspec.h"
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Gaussian pyramid: level 0 is the image, each further level the previous one
+// smoothed with a 5x5 GaussianKernel and decimated by 2 in one pass, down to
+// levels whose shorter side is minSide. Odd sizes round up.
+class Pyramid
+{
+	QImage base;
+	// Levels 1 and up, which imagePyramid() shares between pyramids of one image.
+	std::shared_ptr<const std::vector<QImage>> reduced;
+
+	friend std::shared_ptr<const Pyramid> imagePyramid(const QImage& img);
+	Pyramid(const QImage& base, std::shared_ptr<const std::vector<QImage>> reduced) :
+		base(base), reduced(std::move(reduced)) {}
+public:
+	explicit Pyramid(const QImage& img, int minSide = 16);
+
+	int levels() const
+	{
+		return 1 + int(reduced->size());
+	}
+	const QImage& level(int i) const
+	{
+		return i == 0 ? base : (*reduced)[i - 1];
+	}
+	// Finest level with at most maxPixels pixels, or the coarsest one.
+	int levelFor(qint64 maxPixels) const;
+};
+
+// Pyramid of img, with the reduced levels cached by QImage::cacheKey() like
+// imageStats(), so that previews of one source image share them. The cache
+// does not hold img itself, so editing img once the pyramids of it are gone
+// does not copy it; level 0 of the pyramid returned is a shallow copy of img.
+std::shared_ptr<const Pyramid> imagePyramid(const QImage& img);
+
+// Filters at reduced resolution for interactive previews. A spec runs on a
+// pyramid level with its radii scaled to the level (FilterSpec::atLevel), so
+// the preview approximates the full-resolution result at 1/4^level the cost.
+class Preview
+{
+	std::shared_ptr<const Pyramid> pyramid;
+	Kernel* structure;
+public:
+	explicit Preview(const QImage& img, Kernel* structure = nullptr) : pyramid(imagePyramid(img)), structure(structure) {}
+
+	const Pyramid& levels() const
+	{
+		return *pyramid;
+	}
+	// Result at the size of the level. Throws std::out_of_range for levels
+	// the pyramid does not have.
+	QImage render(const FilterSpec& spec, int level) const;
+	// Progressive refinement: renders from level coarsest down to full
+	// resolution and hands each result to show, which returns false to stop,
+	// e.g. when the parameters have changed again.
+	void refine(const FilterSpec& spec, int coarsest, const std::function<bool(const QImage& result, int level)>& show) const;
+};
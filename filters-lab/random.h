@@ -0,0 +1,47 @@
+#pragma once
+#include <cstdint>
+
+// Counter-based random numbers for stochastic filters. Every value is a pure
+// function of (seed, stream, x, y): the pixel is the counter of a SplitMix64
+// sequence, so output for a given seed does not depend on band order, thread
+// count or vector width. stream() gives independent values for the same pixel,
+// e.g. one per coordinate of a displacement.
+class PixelRandom
+{
+public:
+	explicit PixelRandom(std::uint64_t seed = 0) : key(mix(seed * Golden + mix(1)))
+	{
+	}
+
+	PixelRandom stream(std::uint32_t index) const
+	{
+		PixelRandom other(*this);
+		other.key = mix(key ^ mix(std::uint64_t(index) + 1));
+		return other;
+	}
+
+	// Uniform 64-bit value of pixel (x, y).
+	std::uint64_t bits(int x, int y) const
+	{
+		std::uint64_t counter = std::uint64_t(std::uint32_t(y)) << 32 | std::uint32_t(x);
+		return mix(key + counter * Golden);
+	}
+
+	// Uniform in [0, 1), 53 bits.
+	double uniform(int x, int y) const
+	{
+		return double(bits(x, y) >> 11) * (1.0 / 9007199254740992.0);
+	}
+private:
+	static const std::uint64_t Golden = 0x9e3779b97f4a7c15ull;
+
+	std::uint64_t key;
+
+	// SplitMix64 output function.
+	static std::uint64_t mix(std::uint64_t z)
+	{
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+};
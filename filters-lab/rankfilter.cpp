@@ -0,0 +1,145 @@
+#include "rankfilter.h"
+#include "imagepool.h"
+#include <algorithm>
+
+namespace
+{
+	const int Bins = 256;
+	const int CoarseBins = 16;
+
+	// Fine and coarse counts for the three colour channels.
+	struct Histogram
+	{
+		unsigned int* fine;
+		unsigned int* coarse;
+	};
+
+	inline void addPixel(Histogram h, QRgb color, int delta)
+	{
+		int values[3] = { qRed(color), qGreen(color), qBlue(color) };
+		for (int c = 0; c < 3; c++)
+		{
+			h.fine[c * Bins + values[c]] += delta;
+			h.coarse[c * CoarseBins + (values[c] >> 4)] += delta;
+		}
+	}
+
+	inline void addCoarse(unsigned int* to, const unsigned int* from, const unsigned int* minus)
+	{
+		for (int n = 0; n < 3 * CoarseBins; n++)
+			to[n] += from[n] - minus[n];
+	}
+}
+
+void rankFilter(const PixelView& src, const PixelSpan& dst, int begin, int end, int radius, int rank, const Border& border)
+{
+	int w = src.width();
+	int tile = std::max(256, 8 * radius);
+	int size = 2 * radius + 1;
+	BorderedView rows(src, border);
+	// Column histograms of the widest tile and radius columns on either side,
+	// past the image edges included, reused by every tile of the band.
+	std::size_t columns = std::min(w, tile) + 2 * radius;
+	ImagePool::Buffer fineBuffer = ImagePool::shared().buffer(sizeof(unsigned int) * columns * 3 * Bins);
+	ImagePool::Buffer coarseBuffer = ImagePool::shared().buffer(sizeof(unsigned int) * columns * 3 * CoarseBins);
+	unsigned int* fine = fineBuffer.as<unsigned int>();
+	unsigned int* coarse = coarseBuffer.as<unsigned int>();
+	unsigned int windowFine[3 * Bins], windowCoarse[3 * CoarseBins], noCoarse[3 * CoarseBins] = {};
+	// Column at which each 16-bin fine segment of the window was last valid.
+	int validAt[3 * CoarseBins];
+	// Rows leaving and entering the column histograms, where they need a border.
+	ImagePool::Buffer lineBuffer = ImagePool::shared().buffer(2 * sizeof(QRgb) * columns);
+	QRgb* goneLine = lineBuffer.as<QRgb>();
+	QRgb* addedLine = goneLine + columns;
+
+	for (int x0 = 0; x0 < w; x0 += tile)
+	{
+		int x1 = std::min(w, x0 + tile);
+		// Columns the tile's windows touch. Every one has its own histogram,
+		// so the searches below index them without mapping past the edges.
+		int c0 = x0 - radius, c1 = x1 + radius;
+		std::fill(fine, fine + (c1 - c0) * 3 * Bins, 0u);
+		std::fill(coarse, coarse + (c1 - c0) * 3 * CoarseBins, 0u);
+		auto column = [&](int x)
+		{
+			int c = x - c0;
+			Histogram h = { &fine[c * 3 * Bins], &coarse[c * 3 * CoarseBins] };
+			return h;
+		};
+
+		for (int i = -radius; i <= radius; i++)
+		{
+			const QRgb* row = rows.span(begin + i, c0, c1, addedLine);
+			for (int c = c0; c < c1; c++)
+				addPixel(column(c), row[c - c0], 1);
+		}
+
+		for (int y = begin; y < end; y++)
+		{
+			if (y > begin)
+			{
+				const QRgb* gone = rows.span(y - 1 - radius, c0, c1, goneLine);
+				const QRgb* added = rows.span(y + radius, c0, c1, addedLine);
+				for (int c = c0; c < c1; c++)
+				{
+					addPixel(column(c), gone[c - c0], -1);
+					addPixel(column(c), added[c - c0], 1);
+				}
+			}
+
+			// Only the coarse counts slide with every x. A fine segment is
+			// brought up to date when a search descends into it: stepped from
+			// the column it was last valid at, or summed afresh when that is a
+			// whole window behind.
+			std::fill(windowCoarse, windowCoarse + 3 * CoarseBins, 0u);
+			for (int j = -radius; j <= radius; j++)
+				addCoarse(windowCoarse, column(x0 + j).coarse, noCoarse);
+			std::fill(validAt, validAt + 3 * CoarseBins, x0 - size);
+
+			QRgb* out = dst.row(y);
+			for (int x = x0; x < x1; x++)
+			{
+				int values[3];
+				for (int c = 0; c < 3; c++)
+				{
+					const unsigned int* coarse = &windowCoarse[c * CoarseBins];
+					unsigned int seen = 0;
+					int bin = 0;
+					while (seen + coarse[bin] <= unsigned(rank))
+						seen += coarse[bin++];
+
+					int segment = c * Bins + bin * 16;
+					unsigned int* fine = &windowFine[segment];
+					int& valid = validAt[c * CoarseBins + bin];
+					if (x - valid >= size)
+					{
+						std::fill(fine, fine + 16, 0);
+						for (int j = -radius; j <= radius; j++)
+						{
+							const unsigned int* from = column(x + j).fine + segment;
+							for (int n = 0; n < 16; n++)
+								fine[n] += from[n];
+						}
+					}
+					else
+						for (int t = valid + 1; t <= x; t++)
+						{
+							const unsigned int* from = column(t + radius).fine + segment;
+							const unsigned int* minus = column(t - radius - 1).fine + segment;
+							for (int n = 0; n < 16; n++)
+								fine[n] += from[n] - minus[n];
+						}
+					valid = x;
+
+					int value = 0;
+					while (seen + fine[value] <= unsigned(rank))
+						seen += fine[value++];
+					values[c] = bin * 16 + value;
+				}
+				out[x] = qRgb(values[0], values[1], values[2]);
+				if (x + 1 < x1)
+					addCoarse(windowCoarse, column(x + radius + 1).coarse, column(x - radius).coarse);
+			}
+		}
+	}
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include "border.h"
+
+// Rank filter of output rows [begin, end): each channel takes the value at
+// position rank (0-based) of the sorted (2r+1)^2 window, the source extended
+// by border. This is the Perreault-Hebert constant-time scheme: per-column
+// histograms slide down the band one row at a time, and the window's coarse
+// 16-bin histogram slides along the row by adding one column and removing
+// another. Fine bins are only updated for the coarse bin a search enters,
+// lazily from where that segment was last valid. Histograms live in fixed
+// tiles of columns and are reused along the band, so no memory is allocated
+// per pixel.
+void rankFilter(const PixelView& src, const PixelSpan& dst, int begin, int end, int radius, int rank,
+	const Border& border = Border());
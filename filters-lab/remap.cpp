@@ -0,0 +1,244 @@
+#include "remap.h"
+#include "trace.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <list>
+#include <mutex>
+
+namespace
+{
+	const std::size_t CacheBytes = std::size_t(256) << 20;
+	const QRgb Black = 0xff000000u;
+
+	int toFixed(double position, Sampling sampling)
+	{
+		// Positions far outside the image only have to stay outside.
+		position = std::max(-1e6, std::min(1e6, position));
+		if (sampling == Sampling::Nearest)
+			return int(std::floor(position)) * 256;
+		return int(std::floor(position * 256));
+	}
+
+	// (256 - f) * a + f * b per channel, two channels per multiply.
+	inline QRgb mix(QRgb a, QRgb b, int f)
+	{
+		quint32 rb = ((a & 0xff00ffu) * (256 - f) + (b & 0xff00ffu) * f + 0x800080u) >> 8 & 0xff00ffu;
+		quint32 ag = ((a >> 8 & 0xff00ffu) * (256 - f) + (b >> 8 & 0xff00ffu) * f + 0x800080u) & 0xff00ff00u;
+		return rb | ag;
+	}
+
+	inline QRgb fetch(const PixelView& src, int x, int y, RemapBorder border)
+	{
+		if (border == RemapBorder::Black && (x < 0 || x >= src.width() || y < 0 || y >= src.height()))
+			return Black;
+		return src.row(src.clampY(y))[src.clampX(x)];
+	}
+
+	struct CacheEntry
+	{
+		std::string key;
+		int width, height;
+		// Ready once the thread that added the entry has built the table.
+		std::shared_future<std::shared_ptr<const RemapTable>> table;
+		// 0 while the table is being built; such entries are not evicted.
+		std::size_t bytes;
+	};
+
+	std::mutex cacheLock;
+	// Most recently used first.
+	std::list<CacheEntry> cache;
+}
+
+RemapTable::RemapTable(Kind kind, int width, int height, Sampling sampling, RemapBorder border) :
+	kind(kind), sampling(sampling), border(border), w(width), h(height)
+{
+}
+
+RemapTable RemapTable::rows(int width, int height, int dy, const std::function<double(int)>& shift, Sampling sampling, RemapBorder border)
+{
+	RemapTable table(Kind::Rows, width, height, sampling, border);
+	table.dy = dy;
+	table.rowReach = std::abs(dy);
+	table.along.resize(height);
+	for (int y = 0; y < height; y++)
+		table.along[y] = toFixed(shift(y), sampling);
+	return table;
+}
+
+RemapTable RemapTable::columns(int width, int height, const std::function<double(int)>& sourceX, Sampling sampling, RemapBorder border)
+{
+	RemapTable table(Kind::Columns, width, height, sampling, border);
+	table.along.resize(width);
+	for (int x = 0; x < width; x++)
+	{
+		int position = toFixed(sourceX(x), sampling);
+		// Clamped nearest columns can be resolved once here.
+		if (sampling == Sampling::Nearest && border == RemapBorder::Clamp)
+			position = std::max(0, std::min(width - 1, position >> 8)) * 256;
+		table.along[x] = position;
+	}
+	return table;
+}
+
+RemapTable RemapTable::pixels(int width, int height, const std::function<void(int, int, double&, double&)>& source, Sampling sampling, RemapBorder border)
+{
+	RemapTable table(Kind::Pixels, width, height, sampling, border);
+	table.positions.resize(std::size_t(width) * height);
+	for (int y = 0; y < height; y++)
+		for (int x = 0; x < width; x++)
+		{
+			double sx = x, sy = y;
+			source(x, y, sx, sy);
+			Position& p = table.positions[std::size_t(y) * width + x];
+			p.x = toFixed(sx, sampling);
+			p.y = toFixed(sy, sampling);
+			int above = y - (p.y >> 8), below = (p.y >> 8) + ((p.y & 255) ? 1 : 0) - y;
+			table.rowReach = std::max({ table.rowReach, above, below });
+		}
+	return table;
+}
+
+std::size_t RemapTable::bytes() const
+{
+	return along.size() * sizeof(int) + positions.size() * sizeof(Position);
+}
+
+void RemapTable::applyRow(const PixelView& src, QRgb* out, int y) const
+{
+	if (kind == Kind::Pixels)
+	{
+		const Position* p = &positions[std::size_t(y) * w];
+		for (int x = 0; x < w; x++)
+		{
+			int sx = p[x].x >> 8, sy = p[x].y >> 8;
+			int fx = p[x].x & 255, fy = p[x].y & 255;
+			QRgb color = fetch(src, sx, sy, border);
+			if (fx)
+				color = mix(color, fetch(src, sx + 1, sy, border), fx);
+			if (fy)
+			{
+				QRgb next = fetch(src, sx, sy + 1, border);
+				if (fx)
+					next = mix(next, fetch(src, sx + 1, sy + 1, border), fx);
+				color = mix(color, next, fy);
+			}
+			out[x] = color;
+		}
+		return;
+	}
+
+	int sy = kind == Kind::Rows ? y + dy : y;
+	if (border == RemapBorder::Black && (sy < 0 || sy >= h))
+	{
+		std::fill(out, out + w, Black);
+		return;
+	}
+	const QRgb* in = src.row(src.clampY(sy));
+	auto at = [&](int x)
+	{
+		if (x >= 0 && x < w)
+			return in[x];
+		return border == RemapBorder::Black ? Black : in[x < 0 ? 0 : w - 1];
+	};
+
+	if (kind == Kind::Columns)
+	{
+		if (sampling == Sampling::Nearest && border == RemapBorder::Clamp)
+		{
+			for (int x = 0; x < w; x++)
+				out[x] = in[along[x] >> 8];
+			return;
+		}
+		for (int x = 0; x < w; x++)
+		{
+			int sx = along[x] >> 8, f = along[x] & 255;
+			out[x] = f ? mix(at(sx), at(sx + 1), f) : at(sx);
+		}
+		return;
+	}
+
+	int shift = along[y] >> 8, f = along[y] & 255;
+	if (f)
+	{
+		for (int x = 0; x < w; x++)
+			out[x] = mix(at(x + shift), at(x + shift + 1), f);
+		return;
+	}
+	// Whole-pixel shift: x in [first, last) reads in[x + shift].
+	int first = std::max(0, std::min(w, -shift));
+	int last = std::max(first, std::min(w, w - shift));
+	std::fill(out, out + first, at(-1));
+	if (last > first)
+		std::memcpy(out + first, in + first + shift, std::size_t(last - first) * sizeof(QRgb));
+	std::fill(out + last, out + w, at(w));
+}
+
+void RemapTable::apply(const PixelView& src, const PixelSpan& dst, int begin, int end) const
+{
+	for (int y = begin; y < end; y++)
+		applyRow(src, dst.row(y), y);
+}
+
+std::shared_ptr<const RemapTable> cachedRemap(const std::string& key, int width, int height, const std::function<RemapTable()>& build)
+{
+	std::promise<std::shared_ptr<const RemapTable>> promise;
+	std::shared_future<std::shared_ptr<const RemapTable>> cached;
+	std::list<CacheEntry>::iterator added;
+	{
+		std::lock_guard<std::mutex> guard(cacheLock);
+		for (auto entry = cache.begin(); entry != cache.end() && !cached.valid(); ++entry)
+			if (entry->width == width && entry->height == height && entry->key == key)
+			{
+				cache.splice(cache.begin(), cache, entry);
+				cached = entry->table;
+			}
+		if (!cached.valid())
+		{
+			cache.push_front({ key, width, height, promise.get_future().share(), 0 });
+			added = cache.begin();
+		}
+	}
+	// Waits if another thread is still building the table.
+	if (cached.valid())
+		return cached.get();
+
+	// Built outside the lock, so that tables of other keys are found and
+	// built meanwhile; threads asking for this key wait on the future.
+	std::shared_ptr<const RemapTable> table;
+	try
+	{
+		table = std::make_shared<const RemapTable>(build());
+	}
+	catch (...)
+	{
+		{
+			std::lock_guard<std::mutex> guard(cacheLock);
+			cache.erase(added);
+		}
+		promise.set_exception(std::current_exception());
+		throw;
+	}
+	CGLAB_TRACE_ALLOCATED(table->bytes());
+
+	{
+		std::lock_guard<std::mutex> guard(cacheLock);
+		added->bytes = std::max<std::size_t>(table->bytes(), 1);
+		std::size_t total = 0;
+		for (auto entry = cache.begin(); entry != cache.end(); )
+		{
+			if (entry->bytes == 0)
+				++entry;
+			else if (entry != added && total + entry->bytes > CacheBytes)
+				entry = cache.erase(entry);
+			else
+			{
+				total += entry->bytes;
+				++entry;
+			}
+		}
+	}
+	promise.set_value(table);
+	return table;
+}
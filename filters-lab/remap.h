@@ -0,0 +1,86 @@
+#pragma once
+#include "pixelview.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Nearest takes the pixel at the floor of a source position, which is what
+// the filters always did; Bilinear blends the four around it.
+enum class Sampling
+{
+	Nearest,
+	Bilinear
+};
+
+// Value of source pixels outside the image.
+enum class RemapBorder
+{
+	Clamp,	// the nearest edge pixel
+	Black	// opaque black
+};
+
+// Source position of every output pixel for one image size, applied as a
+// gather. Positions are stored in the cheapest form the map allows:
+// - rows: output row y reads source row y + dy, shifted by shift(y). Rows
+//   with a whole-pixel shift are a memcpy plus a border fill.
+// - columns: output pixel (x, y) reads (sourceX(x), y).
+// - pixels: a source position per pixel.
+// Positions keep 8 fractional bits, which only bilinear sampling uses.
+class RemapTable
+{
+public:
+	static RemapTable rows(int width, int height, int dy, const std::function<double(int)>& shift, Sampling sampling, RemapBorder border);
+	static RemapTable columns(int width, int height, const std::function<double(int)>& sourceX, Sampling sampling, RemapBorder border);
+	static RemapTable pixels(int width, int height, const std::function<void(int, int, double&, double&)>& source, Sampling sampling, RemapBorder border);
+
+	int width() const
+	{
+		return w;
+	}
+	int height() const
+	{
+		return h;
+	}
+	// Rows above or below an output row that it may read.
+	int reach() const
+	{
+		return rowReach;
+	}
+	std::size_t bytes() const;
+	// Computes output rows [begin, end); src must hold the rows they reach.
+	void apply(const PixelView& src, const PixelSpan& dst, int begin, int end) const;
+private:
+	enum class Kind
+	{
+		Rows,
+		Columns,
+		Pixels
+	};
+	// Fixed-point source position, 24.8.
+	struct Position
+	{
+		int x, y;
+	};
+
+	Kind kind = Kind::Rows;
+	Sampling sampling = Sampling::Nearest;
+	RemapBorder border = RemapBorder::Clamp;
+	int w = 0, h = 0;
+	int dy = 0;
+	int rowReach = 0;
+	// Fixed-point shift per row (Rows) or source x per column (Columns).
+	std::vector<int> along;
+	// Per pixel (Pixels).
+	std::vector<Position> positions;
+
+	RemapTable(Kind kind, int width, int height, Sampling sampling, RemapBorder border);
+	void applyRow(const PixelView& src, QRgb* out, int y) const;
+};
+
+// Process-wide cache of remap tables keyed by (key, width, height), so that a
+// sequence of same-sized frames builds each map once. Holds up to 256 MB,
+// evicting the least recently used tables. build() runs outside the cache
+// lock; threads asking for a table that is being built wait for it, and an
+// exception from build() reaches all of them.
+std::shared_ptr<const RemapTable> cachedRemap(const std::string& key, int width, int height, const std::function<RemapTable()>& build);
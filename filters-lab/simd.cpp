@@ -0,0 +1,103 @@
+#include "simd.h"
+#include <atomic>
+
+#if defined(CGLAB_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace
+{
+#if defined(CGLAB_X86)
+	void cpuid(int leaf, int subleaf, unsigned int regs[4])
+	{
+#if defined(_MSC_VER)
+		int out[4];
+		__cpuidex(out, leaf, subleaf);
+		for (int i = 0; i < 4; i++)
+			regs[i] = unsigned(out[i]);
+#else
+		__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	}
+
+	unsigned long long xgetbv()
+	{
+#if defined(_MSC_VER)
+		return _xgetbv(0);
+#else
+		unsigned int lo, hi;
+		__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+		return (static_cast<unsigned long long>(hi) << 32) | lo;
+#endif
+	}
+#endif
+
+	std::atomic<int> selected(-1);
+}
+
+SimdLevel detectSimdLevel()
+{
+#if defined(CGLAB_X86)
+	unsigned int regs[4];
+	cpuid(0, 0, regs);
+	unsigned int maxLeaf = regs[0];
+	cpuid(1, 0, regs);
+	bool sse41 = regs[2] & (1u << 19);
+	bool osxsave = regs[2] & (1u << 27);
+	bool avx = regs[2] & (1u << 28);
+	if (!sse41)
+		return SimdLevel::Scalar;
+	if (!osxsave || !avx || maxLeaf < 7)
+		return SimdLevel::SSE41;
+
+	unsigned long long xcr0 = xgetbv();
+	if ((xcr0 & 0x6) != 0x6)
+		return SimdLevel::SSE41;
+	cpuid(7, 0, regs);
+	bool avx2 = regs[1] & (1u << 5);
+	bool avx512f = regs[1] & (1u << 16);
+	if (!avx2)
+		return SimdLevel::SSE41;
+	if (avx512f && (xcr0 & 0xe6) == 0xe6)
+		return SimdLevel::AVX512;
+	return SimdLevel::AVX2;
+#else
+	return SimdLevel::Scalar;
+#endif
+}
+
+SimdLevel simdLevel()
+{
+	int level = selected.load();
+	if (level < 0)
+	{
+		level = int(detectSimdLevel());
+		selected = level;
+	}
+	return SimdLevel(level);
+}
+
+void setSimdLevel(SimdLevel level)
+{
+	SimdLevel detected = detectSimdLevel();
+	selected = int(level < detected ? level : detected);
+}
+
+const char* simdLevelName(SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdLevel::SSE41:
+		return "sse4.1";
+	case SimdLevel::AVX2:
+		return "avx2";
+	case SimdLevel::AVX512:
+		return "avx512";
+	default:
+		return "scalar";
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+// Instruction sets with hand-written kernels, in increasing order.
+enum class SimdLevel
+{
+	Scalar,
+	SSE41,
+	AVX2,
+	AVX512
+};
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CGLAB_X86 1
+#endif
+
+// GCC and Clang need per-function target attributes to emit AVX code in a
+// baseline build; MSVC accepts the intrinsics as they are.
+#if defined(CGLAB_X86) && (defined(__GNUC__) || defined(__clang__))
+#define CGLAB_TARGET(isa) __attribute__((target(isa)))
+#else
+#define CGLAB_TARGET(isa)
+#endif
+
+// Fully unrolls the loop that follows over a compile-time count, so that
+// arrays of vector accumulators stay in registers. MSVC unrolls such loops
+// on its own.
+#if defined(__GNUC__) || defined(__clang__)
+#define CGLAB_UNROLL _Pragma("GCC unroll 16")
+#else
+#define CGLAB_UNROLL
+#endif
+
+// Best level supported by both the CPU (CPUID) and the OS (XGETBV).
+SimdLevel detectSimdLevel();
+// Level the dispatched kernels use: the detected one unless lowered with setSimdLevel.
+SimdLevel simdLevel();
+// Caps the level, e.g. to compare against the scalar path. Levels above the
+// detected one are ignored.
+void setSimdLevel(SimdLevel level);
+const char* simdLevelName(SimdLevel level);
@@ -0,0 +1,383 @@
+#include "sobel.h"
+#include "filter.h"
+#include "simd.h"
+#include <cmath>
+
+#if defined(CGLAB_X86)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+	// s = a + 2b + c and d = c - a over bytes [begin, end) of three luma rows.
+	typedef void (*VerticalKernel)(const uchar* a, const uchar* b, const uchar* c, qint16* s, qint16* d, int begin, int end);
+	// gx[x] = s[x + 1] - s[x - 1] and gy[x] = d[x - 1] + 2 d[x] + d[x + 1].
+	typedef void (*HorizontalKernel)(const qint16* s, const qint16* d, qint16* gx, qint16* gy, int begin, int end);
+	typedef void (*MagnitudeKernel)(const qint16* gx, const qint16* gy, qint16* m, int begin, int end);
+	// Orientation bins through a table indexed by 4 sector + 2 (gx < 0) + (gy <= 0).
+	typedef void (*OrientationKernel)(const qint16* gx, const qint16* gy, const uchar* table, uchar* out, int begin, int end);
+
+	void verticalScalar(const uchar* a, const uchar* b, const uchar* c, qint16* s, qint16* d, int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			s[i] = qint16(a[i] + 2 * b[i] + c[i]);
+			d[i] = qint16(c[i] - a[i]);
+		}
+	}
+
+	void horizontalScalar(const qint16* s, const qint16* d, qint16* gx, qint16* gy, int begin, int end)
+	{
+		for (int x = begin; x < end; x++)
+		{
+			gx[x] = qint16(s[x + 1] - s[x - 1]);
+			gy[x] = qint16(d[x - 1] + 2 * d[x] + d[x + 1]);
+		}
+	}
+
+	void magnitudeL1Scalar(const qint16* gx, const qint16* gy, qint16* m, int begin, int end)
+	{
+		for (int x = begin; x < end; x++)
+			m[x] = qint16(std::abs(gx[x]) + std::abs(gy[x]));
+	}
+
+	// sqrt of an integer is never within float rounding of a half, so this
+	// and the float SIMD kernels round to the same value.
+	void magnitudeL2Scalar(const qint16* gx, const qint16* gy, qint16* m, int begin, int end)
+	{
+		for (int x = begin; x < end; x++)
+			m[x] = qint16(std::lround(std::sqrt(double(gx[x] * gx[x] + gy[x] * gy[x]))));
+	}
+
+	// Sectors are near-horizontal, diagonal and near-vertical; tan(22.5 degrees)
+	// is 408 / 985 to 1e-6. Both tests hold only for a zero gradient, which
+	// lands in sector 0.
+	void orientationScalar(const qint16* gx, const qint16* gy, const uchar* table, uchar* out, int begin, int end)
+	{
+		for (int x = begin; x < end; x++)
+		{
+			int ax = std::abs(gx[x]), ay = std::abs(gy[x]);
+			int horizontal = ay * 985 <= ax * 408;
+			int vertical = ax * 985 <= ay * 408;
+			int sector = 1 - horizontal + (vertical & (1 - horizontal));
+			out[x] = table[sector * 4 + (gx[x] < 0) * 2 + (gy[x] <= 0)];
+		}
+	}
+
+#if defined(CGLAB_X86)
+	// 16 pixels per step.
+	CGLAB_TARGET("sse4.1")
+	void verticalSSE41(const uchar* a, const uchar* b, const uchar* c, qint16* s, qint16* d, int begin, int end)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		int i = begin;
+		for (; i + 16 <= end; i += 16)
+		{
+			__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+			__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+			__m128i vc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c + i));
+			__m128i a0 = _mm_unpacklo_epi8(va, zero), a1 = _mm_unpackhi_epi8(va, zero);
+			__m128i b0 = _mm_unpacklo_epi8(vb, zero), b1 = _mm_unpackhi_epi8(vb, zero);
+			__m128i c0 = _mm_unpacklo_epi8(vc, zero), c1 = _mm_unpackhi_epi8(vc, zero);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(s + i), _mm_add_epi16(_mm_add_epi16(a0, c0), _mm_slli_epi16(b0, 1)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(s + i + 8), _mm_add_epi16(_mm_add_epi16(a1, c1), _mm_slli_epi16(b1, 1)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(d + i), _mm_sub_epi16(c0, a0));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(d + i + 8), _mm_sub_epi16(c1, a1));
+		}
+		verticalScalar(a, b, c, s, d, i, end);
+	}
+
+	CGLAB_TARGET("sse4.1")
+	void horizontalSSE41(const qint16* s, const qint16* d, qint16* gx, qint16* gy, int begin, int end)
+	{
+		int x = begin;
+		for (; x + 8 <= end; x += 8)
+		{
+			__m128i left = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + x - 1));
+			__m128i right = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + x + 1));
+			__m128i above = _mm_loadu_si128(reinterpret_cast<const __m128i*>(d + x - 1));
+			__m128i middle = _mm_loadu_si128(reinterpret_cast<const __m128i*>(d + x));
+			__m128i below = _mm_loadu_si128(reinterpret_cast<const __m128i*>(d + x + 1));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(gx + x), _mm_sub_epi16(right, left));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(gy + x), _mm_add_epi16(_mm_add_epi16(above, below), _mm_slli_epi16(middle, 1)));
+		}
+		horizontalScalar(s, d, gx, gy, x, end);
+	}
+
+	CGLAB_TARGET("sse4.1")
+	void magnitudeL1SSE41(const qint16* gx, const qint16* gy, qint16* m, int begin, int end)
+	{
+		int x = begin;
+		for (; x + 8 <= end; x += 8)
+		{
+			__m128i a = _mm_abs_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(gx + x)));
+			__m128i b = _mm_abs_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(gy + x)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(m + x), _mm_add_epi16(a, b));
+		}
+		magnitudeL1Scalar(gx, gy, m, x, end);
+	}
+
+	// pmaddwd of interleaved (gx, gy) pairs with themselves is gx^2 + gy^2.
+	CGLAB_TARGET("sse4.1")
+	void magnitudeL2SSE41(const qint16* gx, const qint16* gy, qint16* m, int begin, int end)
+	{
+		int x = begin;
+		for (; x + 8 <= end; x += 8)
+		{
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(gx + x));
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(gy + x));
+			__m128i lo = _mm_unpacklo_epi16(a, b), hi = _mm_unpackhi_epi16(a, b);
+			__m128i r0 = _mm_cvtps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(_mm_madd_epi16(lo, lo))));
+			__m128i r1 = _mm_cvtps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(_mm_madd_epi16(hi, hi))));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(m + x), _mm_packs_epi32(r0, r1));
+		}
+		magnitudeL2Scalar(gx, gy, m, x, end);
+	}
+
+	// The sector tests as a 985 - b 408 <= 0 through pmaddwd, masks combined
+	// into the table index and looked up with pshufb.
+	CGLAB_TARGET("sse4.1")
+	void orientationSSE41(const qint16* gx, const qint16* gy, const uchar* table, uchar* out, int begin, int end)
+	{
+		const __m128i weights = _mm_set1_epi32(985 | (-408 << 16));
+		const __m128i one = _mm_set1_epi32(1), four = _mm_set1_epi16(4);
+		const __m128i lut = _mm_loadu_si128(reinterpret_cast<const __m128i*>(table));
+		int x = begin;
+		for (; x + 8 <= end; x += 8)
+		{
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(gx + x));
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(gy + x));
+			__m128i ax = _mm_abs_epi16(a), ay = _mm_abs_epi16(b);
+			__m128i horizontal = _mm_packs_epi32(
+				_mm_cmplt_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(ay, ax), weights), one),
+				_mm_cmplt_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(ay, ax), weights), one));
+			__m128i vertical = _mm_packs_epi32(
+				_mm_cmplt_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(ax, ay), weights), one),
+				_mm_cmplt_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(ax, ay), weights), one));
+			// Masks are -1, so 4 + 4 horizontal - 4 (vertical and not horizontal) - 2 (gx < 0) - (gy <= 0).
+			__m128i index = _mm_add_epi16(four, _mm_slli_epi16(_mm_sub_epi16(horizontal, _mm_andnot_si128(horizontal, vertical)), 2));
+			index = _mm_sub_epi16(index, _mm_slli_epi16(_mm_cmplt_epi16(a, _mm_setzero_si128()), 1));
+			index = _mm_sub_epi16(index, _mm_cmplt_epi16(b, _mm_set1_epi16(1)));
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out + x), _mm_shuffle_epi8(lut, _mm_packus_epi16(index, index)));
+		}
+		orientationScalar(gx, gy, table, out, x, end);
+	}
+
+	// 16 pixels per step, widened straight to int16.
+	CGLAB_TARGET("avx2")
+	void verticalAVX2(const uchar* a, const uchar* b, const uchar* c, qint16* s, qint16* d, int begin, int end)
+	{
+		int i = begin;
+		for (; i + 16 <= end; i += 16)
+		{
+			__m256i va = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+			__m256i vb = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+			__m256i vc = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(c + i)));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(s + i), _mm256_add_epi16(_mm256_add_epi16(va, vc), _mm256_slli_epi16(vb, 1)));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(d + i), _mm256_sub_epi16(vc, va));
+		}
+		verticalSSE41(a, b, c, s, d, i, end);
+	}
+
+	CGLAB_TARGET("avx2")
+	void horizontalAVX2(const qint16* s, const qint16* d, qint16* gx, qint16* gy, int begin, int end)
+	{
+		int x = begin;
+		for (; x + 16 <= end; x += 16)
+		{
+			__m256i left = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + x - 1));
+			__m256i right = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + x + 1));
+			__m256i above = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(d + x - 1));
+			__m256i middle = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(d + x));
+			__m256i below = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(d + x + 1));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(gx + x), _mm256_sub_epi16(right, left));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(gy + x), _mm256_add_epi16(_mm256_add_epi16(above, below), _mm256_slli_epi16(middle, 1)));
+		}
+		horizontalSSE41(s, d, gx, gy, x, end);
+	}
+
+	CGLAB_TARGET("avx2")
+	void magnitudeL1AVX2(const qint16* gx, const qint16* gy, qint16* m, int begin, int end)
+	{
+		int x = begin;
+		for (; x + 16 <= end; x += 16)
+		{
+			__m256i a = _mm256_abs_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(gx + x)));
+			__m256i b = _mm256_abs_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(gy + x)));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(m + x), _mm256_add_epi16(a, b));
+		}
+		magnitudeL1SSE41(gx, gy, m, x, end);
+	}
+
+	// unpack and pack both work within 128-bit lanes, so the order comes out right.
+	CGLAB_TARGET("avx2")
+	void magnitudeL2AVX2(const qint16* gx, const qint16* gy, qint16* m, int begin, int end)
+	{
+		int x = begin;
+		for (; x + 16 <= end; x += 16)
+		{
+			__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(gx + x));
+			__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(gy + x));
+			__m256i lo = _mm256_unpacklo_epi16(a, b), hi = _mm256_unpackhi_epi16(a, b);
+			__m256i r0 = _mm256_cvtps_epi32(_mm256_sqrt_ps(_mm256_cvtepi32_ps(_mm256_madd_epi16(lo, lo))));
+			__m256i r1 = _mm256_cvtps_epi32(_mm256_sqrt_ps(_mm256_cvtepi32_ps(_mm256_madd_epi16(hi, hi))));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(m + x), _mm256_packs_epi32(r0, r1));
+		}
+		magnitudeL2SSE41(gx, gy, m, x, end);
+	}
+	CGLAB_TARGET("avx2")
+	void orientationAVX2(const qint16* gx, const qint16* gy, const uchar* table, uchar* out, int begin, int end)
+	{
+		const __m256i weights = _mm256_set1_epi32(985 | (-408 << 16));
+		const __m256i one = _mm256_set1_epi32(1), four = _mm256_set1_epi16(4);
+		const __m256i lut = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(table)));
+		int x = begin;
+		for (; x + 16 <= end; x += 16)
+		{
+			__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(gx + x));
+			__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(gy + x));
+			__m256i ax = _mm256_abs_epi16(a), ay = _mm256_abs_epi16(b);
+			__m256i horizontal = _mm256_packs_epi32(
+				_mm256_cmpgt_epi32(one, _mm256_madd_epi16(_mm256_unpacklo_epi16(ay, ax), weights)),
+				_mm256_cmpgt_epi32(one, _mm256_madd_epi16(_mm256_unpackhi_epi16(ay, ax), weights)));
+			__m256i vertical = _mm256_packs_epi32(
+				_mm256_cmpgt_epi32(one, _mm256_madd_epi16(_mm256_unpacklo_epi16(ax, ay), weights)),
+				_mm256_cmpgt_epi32(one, _mm256_madd_epi16(_mm256_unpackhi_epi16(ax, ay), weights)));
+			__m256i index = _mm256_add_epi16(four, _mm256_slli_epi16(_mm256_sub_epi16(horizontal, _mm256_andnot_si256(horizontal, vertical)), 2));
+			index = _mm256_sub_epi16(index, _mm256_slli_epi16(_mm256_cmpgt_epi16(_mm256_setzero_si256(), a), 1));
+			index = _mm256_sub_epi16(index, _mm256_cmpgt_epi16(_mm256_set1_epi16(1), b));
+			// Each lane packs its eight indices twice; gather the first copies.
+			__m256i bins = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(lut, _mm256_packus_epi16(index, index)), 0x08);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm256_castsi256_si128(bins));
+		}
+		orientationSSE41(gx, gy, table, out, x, end);
+	}
+#endif
+
+	struct Kernels
+	{
+		VerticalKernel vertical;
+		HorizontalKernel horizontal;
+		MagnitudeKernel l1, l2;
+		OrientationKernel orientation;
+	};
+
+	Kernels kernels()
+	{
+		switch (simdLevel())
+		{
+#if defined(CGLAB_X86)
+		case SimdLevel::AVX512:
+		case SimdLevel::AVX2:
+			return { verticalAVX2, horizontalAVX2, magnitudeL1AVX2, magnitudeL2AVX2, orientationAVX2 };
+		case SimdLevel::SSE41:
+			return { verticalSSE41, horizontalSSE41, magnitudeL1SSE41, magnitudeL2SSE41, orientationSSE41 };
+#endif
+		default:
+			return { verticalScalar, horizontalScalar, magnitudeL1Scalar, magnitudeL2Scalar, orientationScalar };
+		}
+	}
+
+	// Luma of row y with one clamped pixel on each side.
+	void lumaRow(const PixelView& src, int y, uchar* out)
+	{
+		const QRgb* row = src.row(src.clampY(y));
+		int w = src.width();
+		for (int x = 0; x < w; x++)
+			out[x + 1] = uchar((77 * qRed(row[x]) + 150 * qGreen(row[x]) + 29 * qBlue(row[x]) + 128) >> 8);
+		out[0] = out[1];
+		out[w + 1] = out[w];
+	}
+}
+
+void sobelRows(const PixelView& src, int begin, int end, const SobelOptions& options,
+	const std::function<void(int, const SobelRow&)>& sink)
+{
+	int w = src.width();
+	Kernels k = kernels();
+	bool magnitude = options.planes & SobelMagnitude;
+	bool orientation = options.planes & SobelOrientation;
+
+	// Three luma rows and the orientations, then s, d over the padded width
+	// and the gradient rows.
+	ImagePool::Buffer byteBuffer = ImagePool::shared().buffer(3 * (w + 2) + w);
+	uchar* luma = byteBuffer.as<uchar>();
+	uchar* rows[3] = { luma, luma + (w + 2), luma + 2 * (w + 2) };
+	uchar* o = luma + 3 * (w + 2);
+	ImagePool::Buffer wordBuffer = ImagePool::shared().buffer(sizeof(qint16) * (2 * (w + 2) + 3 * w));
+	qint16* s = wordBuffer.as<qint16>();
+	qint16* d = s + (w + 2);
+	qint16* gx = d + (w + 2);
+	qint16* gy = gx + w;
+	qint16* m = gy + w;
+
+	// Eighths of a turn by table index; 16 entries for pshufb.
+	static const uchar octants[16] = { 0, 0, 4, 4, 1, 7, 3, 5, 2, 6, 2, 6 };
+	uchar table[16];
+	for (int i = 0; i < 16; i++)
+		table[i] = uchar(octants[i] % options.orientationBins);
+
+	lumaRow(src, begin - 1, rows[0]);
+	lumaRow(src, begin, rows[1]);
+	for (int y = begin; y < end; y++)
+	{
+		if (y > begin)
+			std::swap(rows[0], rows[1]), std::swap(rows[1], rows[2]);
+		lumaRow(src, y + 1, rows[2]);
+
+		k.vertical(rows[0], rows[1], rows[2], s, d, 0, w + 2);
+		k.horizontal(s + 1, d + 1, gx, gy, 0, w);
+		if (magnitude)
+			(options.norm == GradientNorm::L1 ? k.l1 : k.l2)(gx, gy, m, 0, w);
+		if (orientation)
+			k.orientation(gx, gy, table, o, 0, w);
+
+		SobelRow row = { gx, gy, magnitude ? m : nullptr, orientation ? o : nullptr };
+		sink(y, row);
+	}
+}
+
+SobelPlanes sobelGradients(const QImage& img, const SobelOptions& options)
+{
+	if (!PixelView::isSupported(img.format()))
+		return sobelGradients(img.convertToFormat(QImage::Format_ARGB32), options);
+
+	CGLAB_TRACE_SCOPE("SobelGradients", "process");
+	SobelPlanes planes;
+	int w = planes.width = img.width();
+	int h = planes.height = img.height();
+	std::size_t size = std::size_t(w) * h;
+	bool narrow = options.planes & SobelEightBit;
+	if (options.planes & SobelGx)
+		narrow ? planes.gx8.resize(size) : planes.gx.resize(size);
+	if (options.planes & SobelGy)
+		narrow ? planes.gy8.resize(size) : planes.gy.resize(size);
+	if (options.planes & SobelMagnitude)
+		narrow ? planes.magnitude8.resize(size) : planes.magnitude.resize(size);
+	if (options.planes & SobelOrientation)
+		planes.orientation.resize(size);
+
+	PixelView src(img);
+	auto copy = [w](const qint16* row, std::vector<qint16>& wide, std::vector<uchar>& eight, int offset, std::size_t at)
+	{
+		if (!wide.empty())
+			std::copy(row, row + w, wide.begin() + at);
+		else if (!eight.empty())
+			for (int x = 0; x < w; x++)
+				eight[at + x] = uchar(offset + (row[x] >> 3));
+	};
+	forEachBand(h, [&](int begin, int end)
+	{
+		sobelRows(src, begin, end, options, [&](int y, const SobelRow& row)
+		{
+			std::size_t at = std::size_t(y) * w;
+			copy(row.gx, planes.gx, planes.gx8, 128, at);
+			copy(row.gy, planes.gy, planes.gy8, 128, at);
+			if (row.magnitude)
+				copy(row.magnitude, planes.magnitude, planes.magnitude8, 0, at);
+			if (row.orientation)
+				std::copy(row.orientation, row.orientation + w, planes.orientation.begin() + at);
+		});
+	}, 1);
+	return planes;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "pixelview.h"
+#include <functional>
+#include <vector>
+
+// Planes the fused Sobel operator can produce, or'ed together.
+enum SobelPlane
+{
+	SobelGx = 1,
+	SobelGy = 2,
+	SobelMagnitude = 4,
+	SobelOrientation = 8,
+	// Store Gx, Gy and magnitude in 8 bits: value / 8, plus 128 for Gx and Gy.
+	// Nothing saturates at that scale.
+	SobelEightBit = 16
+};
+
+enum class GradientNorm
+{
+	L1,	// |Gx| + |Gy|, up to 2040
+	L2	// round(sqrt(Gx^2 + Gy^2)), up to 1443
+};
+
+struct SobelOptions
+{
+	unsigned planes = SobelGx | SobelGy;
+	GradientNorm norm = GradientNorm::L1;
+	// 8: gradient direction in eighths of a turn from +x towards +y (down),
+	// 0 for a zero gradient. 4: the same modulo a half turn, i.e. edge axes.
+	int orientationBins = 8;
+};
+
+// One row of gradients; planes that were not requested are nullptr.
+struct SobelRow
+{
+	const qint16* gx;
+	const qint16* gy;
+	const qint16* magnitude;
+	const uchar* orientation;
+};
+
+// Sobel gradients of the luma (77 R + 150 G + 29 B) / 256 of output rows
+// [begin, end), clamped at the borders. Gx and Gy are [-1 0 1] x [1 2 1] and
+// its transpose, in [-1020, 1020]. Each source row is turned into luma once;
+// the vertical [1 2 1] and [-1 0 1] passes share the three rows in reach and
+// the horizontal passes run on int16 rows with SIMD. sink gets every row.
+void sobelRows(const PixelView& src, int begin, int end, const SobelOptions& options,
+	const std::function<void(int, const SobelRow&)>& sink);
+
+// The requested planes of a whole image, row-major; the others stay empty.
+struct SobelPlanes
+{
+	int width = 0, height = 0;
+	std::vector<qint16> gx, gy, magnitude;
+	std::vector<uchar> gx8, gy8, magnitude8, orientation;
+};
+
+SobelPlanes sobelGradients(const QImage& img, const SobelOptions& options);
@@ -0,0 +1,188 @@
+#pragma once
+#include "border.h"
+#include "imagepool.h"
+#include "simd.h"
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+
+#if defined(CGLAB_X86)
+#include <immintrin.h>
+#endif
+
+// Convolution kernel fixed at compile time: (2 Radius + 1)^2 integer
+// coefficients in row-major order, all divided by Divisor. Runtime kernels
+// loaded by the user stay on Kernel.
+template <int Radius, int Divisor, int... Coeffs>
+struct StaticKernel
+{
+	static constexpr int radius = Radius;
+	static constexpr int size = 2 * Radius + 1;
+	static constexpr int divisor = Divisor;
+	static constexpr int coefficients[sizeof...(Coeffs)] = { Coeffs... };
+	static_assert(sizeof...(Coeffs) == size * size, "StaticKernel needs (2 Radius + 1)^2 coefficients");
+	static_assert(Divisor > 0, "StaticKernel divisor must be positive");
+
+	static constexpr int magnitude()
+	{
+		int total = 0;
+		for (int c : coefficients)
+			total += c < 0 ? -c : c;
+		return total;
+	}
+	// Sums that cannot leave int16 are accumulated in int16, twice the lanes.
+	typedef typename std::conditional<255 * magnitude() <= 32767, short, int>::type Accumulator;
+};
+
+namespace staticconvolution
+{
+	// Tap T of K at byte n; zero coefficients and unit weights fold away.
+	template <class K, std::size_t T>
+	inline typename K::Accumulator tap(const uchar* const* rows, int n)
+	{
+		typedef typename K::Accumulator A;
+		constexpr int weight = K::coefficients[T];
+		const uchar* in = rows[T / K::size] + 4 * (T % K::size);
+		if constexpr (weight == 0)
+			return 0;
+		else if constexpr (weight == 1)
+			return A(in[n]);
+		else if constexpr (weight == -1)
+			return A(-A(in[n]));
+		else
+			return A(weight * A(in[n]));
+	}
+
+	template <class K, std::size_t... T>
+	inline typename K::Accumulator sum(const uchar* const* rows, int n, std::index_sequence<T...>)
+	{
+		typedef typename K::Accumulator A;
+		return A((A(0) + ... + tap<K, T>(rows, n)));
+	}
+
+	// Bytes [begin, end) of an output row from size padded source rows. The byte
+	// loop has no inner loop left, so the compiler vectorises it whole. The
+	// row pointers are copied first: out may alias them as far as the
+	// compiler knows, and reloading them every byte would block vectorising.
+	template <class K>
+	inline void row(const uchar* const* rows, uchar* out, int begin, int end)
+	{
+		const uchar* local[K::size];
+		std::copy(rows, rows + K::size, local);
+		for (int n = begin; n < end; n++)
+		{
+			int value = sum<K>(local, n, std::make_index_sequence<K::size * K::size>());
+			if (K::divisor != 1)
+				value /= K::divisor;
+			out[n] = uchar(value < 0 ? 0 : (value > 255 ? 255 : value));
+		}
+	}
+
+	template <class K>
+	void rowBaseline(const uchar* const* rows, uchar* out, int end)
+	{
+		row<K>(rows, out, 0, end);
+	}
+
+#if defined(CGLAB_X86)
+	template <class K, std::size_t T>
+	CGLAB_TARGET("avx2")
+	inline void accumulateAVX2(__m256i& acc, const uchar* const* rows, int n)
+	{
+		constexpr int weight = K::coefficients[T];
+		if constexpr (weight != 0)
+		{
+			const uchar* in = rows[T / K::size] + 4 * (T % K::size);
+			__m256i v = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + n)));
+			if constexpr (weight == 1)
+				acc = _mm256_add_epi16(acc, v);
+			else if constexpr (weight == -1)
+				acc = _mm256_sub_epi16(acc, v);
+			else
+				acc = _mm256_add_epi16(acc, _mm256_mullo_epi16(v, _mm256_set1_epi16(short(weight))));
+		}
+	}
+
+	template <class K, std::size_t... T>
+	CGLAB_TARGET("avx2")
+	inline __m256i sumAVX2(const uchar* const* rows, int n, std::index_sequence<T...>)
+	{
+		__m256i acc = _mm256_setzero_si256();
+		(accumulateAVX2<K, T>(acc, rows, n), ...);
+		return acc;
+	}
+
+	constexpr int log2Exact(int value)
+	{
+		return value == 1 ? 0 : (value % 2 ? -1 : (log2Exact(value / 2) < 0 ? -1 : log2Exact(value / 2) + 1));
+	}
+
+	// 16 bytes per step in int16 when the sums fit and the divisor is a
+	// shift; packus saturates to [0, 255]. Other kernels are left to the
+	// compiler's vectoriser at the AVX2 target.
+	template <class K>
+	CGLAB_TARGET("avx2")
+	void rowAVX2(const uchar* const* rows, uchar* out, int end)
+	{
+		constexpr int shift = log2Exact(K::divisor);
+		if constexpr (std::is_same<typename K::Accumulator, short>::value && shift >= 0)
+		{
+			const uchar* local[K::size];
+			std::copy(rows, rows + K::size, local);
+			int n = 0;
+			for (; n + 16 <= end; n += 16)
+			{
+				__m256i acc = _mm256_srai_epi16(sumAVX2<K>(local, n, std::make_index_sequence<K::size * K::size>()), shift);
+				__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(acc, acc), 0x08);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + n), _mm256_castsi256_si128(packed));
+			}
+			row<K>(local, out, n, end);
+		}
+		else
+			row<K>(rows, out, 0, end);
+	}
+#endif
+}
+
+// Convolution of output rows [begin, end) with a StaticKernel, the source
+// extended by border. Integer arithmetic: it equals the Float direct path whenever
+// that path is exact, i.e. for any Divisor that is a power of two.
+template <class K>
+void convolveStatic(const PixelView& src, const PixelSpan& dst, int begin, int end, const Border& border = Border())
+{
+	const int radius = K::radius, size = K::size;
+	int w = src.width();
+	int rowPixels = w + 2 * radius;
+	BorderedView source(src, border);
+	ImagePool::Buffer ringBuffer = ImagePool::shared().buffer(sizeof(QRgb) * rowPixels * size);
+	QRgb* ring = ringBuffer.as<QRgb>();
+
+	auto slot = [&](int y)
+	{
+		return &ring[rowPixels * (((y % size) + size) % size)];
+	};
+	auto padRow = [&](int y)
+	{
+		source.fill(y, -radius, w + radius, slot(y));
+	};
+
+	void (*rowKernel)(const uchar* const*, uchar*, int) = staticconvolution::rowBaseline<K>;
+#if defined(CGLAB_X86)
+	if (simdLevel() >= SimdLevel::AVX2)
+		rowKernel = staticconvolution::rowAVX2<K>;
+#endif
+
+	const uchar* rows[size];
+	for (int y = begin - radius; y < begin + radius; y++)
+		padRow(y);
+	for (int y = begin; y < end; y++)
+	{
+		padRow(y + radius);
+		for (int i = 0; i < size; i++)
+			rows[i] = reinterpret_cast<const uchar*>(slot(y - radius + i));
+		QRgb* out = dst.row(y);
+		rowKernel(rows, reinterpret_cast<uchar*>(out), 4 * w);
+		for (int x = 0; x < w; x++)
+			out[x] |= 0xff000000u;
+	}
+}
@@ -0,0 +1,62 @@
+#include "strips.h"
+#include <filesystem>
+#include <stdexcept>
+
+void StripProcessor::run(const std::string& input, const std::string& output) const
+{
+	if (!filter.isLocal())
+		throw std::invalid_argument("this filter needs the whole image and cannot run in strips");
+
+	CGLAB_TRACE_SCOPE(Trace::nameOf(typeid(filter)), "stream");
+	MappedImage in(input);
+	const NetpbmHeader& head = in.header();
+	int w = head.width, h = head.height;
+	int halo = filter.halo();
+
+	std::filesystem::path target = std::filesystem::u8path(output);
+	NetpbmHeader outHead = head;
+	outHead.channels = target.extension() == ".pam" ? 4 : 3;
+	std::ofstream out(target, std::ios::binary);
+	if (!out)
+		throw std::runtime_error("cannot write " + output);
+	outHead.write(out);
+
+	QImage window = ImagePool::shared().image(w, stripRows + 2 * halo, QImage::Format_ARGB32);
+	QImage result = ImagePool::shared().image(w, stripRows, QImage::Format_ARGB32);
+	uchar* windowBits = window.bits();
+	qsizetype stride = window.bytesPerLine();
+	std::vector<uchar> packed(outHead.rowBytes());
+
+	// Input rows [top, bottom) are held in the window.
+	int top = 0, bottom = 0;
+	for (int y0 = 0; y0 < h; y0 += stripRows)
+	{
+		int y1 = std::min(y0 + stripRows, h);
+		int nextTop = std::max(0, y0 - halo);
+		int nextBottom = std::min(h, y1 + halo);
+		int kept = std::max(0, bottom - nextTop);
+		if (kept > 0 && nextTop > top)
+			std::memmove(windowBits, windowBits + (nextTop - top) * stride, kept * stride);
+		for (int y = std::max(nextTop, bottom); y < nextBottom; y++)
+			unpackRow(in.row(y), w, head.channels, reinterpret_cast<QRgb*>(windowBits + (y - nextTop) * stride));
+		top = nextTop;
+		bottom = nextBottom;
+		in.release(top);
+
+		PixelView src(window, top, h);
+		PixelSpan dst(result, y0, h);
+		ThreadPool::shared().parallelFor(y0, y1, bandHeight(y1 - y0, halo), [&](int begin, int end)
+		{
+			filter.processRows(src, dst, begin, end);
+		});
+
+		for (int y = y0; y < y1; y++)
+		{
+			packRow(dst.row(y), w, outHead.channels, packed.data());
+			out.write(reinterpret_cast<const char*>(packed.data()), packed.size());
+		}
+	}
+	out.flush();
+	if (!out)
+		throw std::runtime_error("cannot write " + output);
+}
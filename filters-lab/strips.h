@@ -0,0 +1,22 @@
+#pragma once
+#include "filter.h"
+#include "netpbm.h"
+
+// Out-of-core driver for images larger than memory. The Netpbm input is mapped
+// and converted in strips of rows. Only strip + 2 * halo() input rows and one
+// strip of output are resident: the overlap rows are carried over from the
+// previous strip, and output rows are written once the strip is done. Runs any
+// filter with isLocal(): MatrixFilter and the morphology filters unless they
+// wrap around the border, point filters and pipelines of them.
+class StripProcessor
+{
+	const Filter& filter;
+	int stripRows;
+public:
+	explicit StripProcessor(const Filter& filter, int stripRows = 256) : filter(filter), stripRows(std::max(stripRows, 1)) {}
+
+	// Writes a PAM with alpha for .pam outputs, a PPM otherwise. Throws
+	// std::invalid_argument for filters that need the whole image and
+	// std::runtime_error on I/O errors.
+	void run(const std::string& input, const std::string& output) const;
+};
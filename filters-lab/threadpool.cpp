@@ -0,0 +1,162 @@
+#include "threadpool.h"
+#include <algorithm>
+#include <exception>
+
+namespace
+{
+	// Queue owned by the current thread: 0 for threads outside any pool.
+	thread_local std::size_t homeQueue = 0;
+
+	std::mutex sharedLock;
+
+	std::unique_ptr<ThreadPool>& sharedPool()
+	{
+		static std::unique_ptr<ThreadPool> pool;
+		return pool;
+	}
+}
+
+ThreadPool::ThreadPool(std::size_t threads) : queued(0), nextQueue(0), stopping(false)
+{
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	for (std::size_t i = 0; i < threads; i++)
+		queues.push_back(std::make_unique<Queue>());
+	for (std::size_t i = 1; i < threads; i++)
+		workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(sleepLock);
+		stopping = true;
+	}
+	wakeUp.notify_all();
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+ThreadPool& ThreadPool::shared()
+{
+	std::lock_guard<std::mutex> guard(sharedLock);
+	std::unique_ptr<ThreadPool>& pool = sharedPool();
+	if (!pool)
+		pool = std::make_unique<ThreadPool>();
+	return *pool;
+}
+
+void ThreadPool::setSharedThreadCount(std::size_t threads)
+{
+	std::lock_guard<std::mutex> guard(sharedLock);
+	std::unique_ptr<ThreadPool>& pool = sharedPool();
+	pool.reset();
+	pool = std::make_unique<ThreadPool>(threads);
+}
+
+void ThreadPool::push(std::function<void()> task)
+{
+	Queue& queue = *queues[nextQueue++ % queues.size()];
+	{
+		std::lock_guard<std::mutex> guard(queue.lock);
+		queue.tasks.push_back(std::move(task));
+	}
+	queued++;
+}
+
+bool ThreadPool::runOne(std::size_t home)
+{
+	std::function<void()> task;
+	for (std::size_t i = 0; i < queues.size() && !task; i++)
+	{
+		Queue& queue = *queues[(home + i) % queues.size()];
+		std::lock_guard<std::mutex> guard(queue.lock);
+		if (queue.tasks.empty())
+			continue;
+		if (i == 0)
+		{
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		}
+		else
+		{
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+	}
+	if (!task)
+		return false;
+	queued--;
+	task();
+	return true;
+}
+
+void ThreadPool::workerLoop(std::size_t index)
+{
+	homeQueue = index;
+	for (;;)
+	{
+		if (runOne(index))
+			continue;
+		std::unique_lock<std::mutex> guard(sleepLock);
+		wakeUp.wait(guard, [this] { return stopping || queued > 0; });
+		if (stopping)
+			return;
+	}
+}
+
+void ThreadPool::parallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body)
+{
+	if (end <= begin)
+		return;
+	grain = std::max(grain, 1);
+	if (workers.empty() || end - begin <= grain)
+	{
+		body(begin, end);
+		return;
+	}
+
+	std::atomic<int> remaining((end - begin + grain - 1) / grain);
+	std::exception_ptr error;
+	std::mutex errorLock;
+	for (int chunk = begin; chunk < end; chunk += grain)
+	{
+		int chunkEnd = std::min(chunk + grain, end);
+		push([&, chunk, chunkEnd]
+		{
+			try
+			{
+				body(chunk, chunkEnd);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> guard(errorLock);
+				if (!error)
+					error = std::current_exception();
+			}
+			// The last chunk wakes the caller, which may be asleep in wakeUp.
+			if (--remaining == 0)
+			{
+				std::lock_guard<std::mutex> guard(sleepLock);
+				wakeUp.notify_all();
+			}
+		});
+	}
+	{
+		std::lock_guard<std::mutex> guard(sleepLock);
+	}
+	wakeUp.notify_all();
+
+	std::size_t home = homeQueue < queues.size() ? homeQueue : 0;
+	while (remaining > 0)
+	{
+		if (runOne(home))
+			continue;
+		// The other chunks are running elsewhere: sleep until they are done
+		// or more work is queued, e.g. by a nested call.
+		std::unique_lock<std::mutex> guard(sleepLock);
+		wakeUp.wait(guard, [&] { return remaining == 0 || queued > 0; });
+	}
+	if (error)
+		std::rethrow_exception(error);
+}
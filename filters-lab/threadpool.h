@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool shared by all filters. Every worker owns a deque: it pops
+// its own work from the back and steals from the front of the others. A thread
+// waiting in parallelFor keeps running queued tasks, so nested calls are safe,
+// and sleeps once the queues are empty until its last chunk finishes.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(std::size_t threads = 0);
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	std::size_t threadCount() const
+	{
+		return workers.size() + 1;
+	}
+	// Calls body(chunkBegin, chunkEnd) over [begin, end) split into chunks of
+	// at most grain items and returns when all chunks are done.
+	void parallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body);
+
+	static ThreadPool& shared();
+	// 0 selects std::thread::hardware_concurrency(). Must not be called while
+	// the shared pool is running work.
+	static void setSharedThreadCount(std::size_t threads);
+private:
+	struct Queue
+	{
+		std::mutex lock;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> workers;
+	std::mutex sleepLock;
+	std::condition_variable wakeUp;
+	std::atomic<int> queued;
+	std::atomic<std::size_t> nextQueue;
+	bool stopping;
+
+	void push(std::function<void()> task);
+	bool runOne(std::size_t home);
+	void workerLoop(std::size_t index);
+};
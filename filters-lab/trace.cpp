@@ -0,0 +1,243 @@
+#include "trace.h"
+
+#if defined(CGLAB_TRACE)
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <typeindex>
+#include <vector>
+#if defined(__GNUC__) || defined(__clang__)
+#include <cxxabi.h>
+#include <cstdlib>
+#endif
+
+namespace
+{
+	struct Event
+	{
+		const char* name;
+		const char* category;
+		// Nanoseconds since Trace::start().
+		long long begin;
+		long long duration;
+		long long pixels;
+		long long bytes;
+		long long rows;
+	};
+
+	// Events of one thread. The lock is only contended while a trace is written.
+	struct Buffer
+	{
+		int thread = 0;
+		std::mutex lock;
+		std::vector<Event> events;
+	};
+
+	std::atomic<bool> recordingNow(false);
+	std::chrono::steady_clock::time_point epoch;
+	// Buffers outlive their threads, so pool threads that were replaced still show up.
+	std::mutex registryLock;
+	std::vector<std::shared_ptr<Buffer>> buffers;
+	std::map<std::type_index, std::string> names;
+
+	thread_local TraceScope* innermost = nullptr;
+
+	long long now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+	}
+
+	Buffer& localBuffer()
+	{
+		thread_local std::shared_ptr<Buffer> buffer;
+		if (!buffer)
+		{
+			std::lock_guard<std::mutex> guard(registryLock);
+			buffer = std::make_shared<Buffer>();
+			buffer->thread = int(buffers.size());
+			buffers.push_back(buffer);
+		}
+		return *buffer;
+	}
+
+	std::vector<Event> allEvents(std::vector<int>& threads)
+	{
+		std::vector<Event> events;
+		std::lock_guard<std::mutex> guard(registryLock);
+		for (const std::shared_ptr<Buffer>& buffer : buffers)
+		{
+			std::lock_guard<std::mutex> bufferGuard(buffer->lock);
+			events.insert(events.end(), buffer->events.begin(), buffer->events.end());
+			threads.insert(threads.end(), buffer->events.size(), buffer->thread);
+		}
+		return events;
+	}
+
+	template <class... Args>
+	std::string line(const char* pattern, Args... args)
+	{
+		char text[256];
+		std::snprintf(text, sizeof(text), pattern, args...);
+		return text;
+	}
+}
+
+void Trace::start()
+{
+	std::lock_guard<std::mutex> guard(registryLock);
+	for (const std::shared_ptr<Buffer>& buffer : buffers)
+	{
+		std::lock_guard<std::mutex> bufferGuard(buffer->lock);
+		buffer->events.clear();
+	}
+	epoch = std::chrono::steady_clock::now();
+	recordingNow.store(true, std::memory_order_release);
+}
+
+void Trace::stop()
+{
+	recordingNow.store(false, std::memory_order_release);
+}
+
+bool Trace::recording()
+{
+	return recordingNow.load(std::memory_order_acquire);
+}
+
+const char* Trace::nameOf(const std::type_info& type)
+{
+	// Each thread remembers the names it has looked up, so that process()
+	// calls only take registryLock the first time a thread sees a type.
+	thread_local std::map<std::type_index, const char*> seen;
+	auto known = seen.find(type);
+	if (known != seen.end())
+		return known->second;
+
+	std::lock_guard<std::mutex> guard(registryLock);
+	auto found = names.find(type);
+	if (found != names.end())
+		return seen[type] = found->second.c_str();
+
+	std::string name = type.name();
+#if defined(__GNUC__) || defined(__clang__)
+	int status = 0;
+	char* demangled = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+	if (status == 0)
+		name = demangled;
+	std::free(demangled);
+#endif
+	for (const char* prefix : { "class ", "struct " })
+		if (name.compare(0, std::strlen(prefix), prefix) == 0)
+			name.erase(0, std::strlen(prefix));
+	std::size_t scope = name.rfind("::");
+	if (scope != std::string::npos)
+		name.erase(0, scope + 2);
+	return seen[type] = names.emplace(type, name).first->second.c_str();
+}
+
+const char* Trace::current()
+{
+	return innermost ? innermost->name : nullptr;
+}
+
+void Trace::allocated(long long bytes)
+{
+	if (innermost)
+		innermost->bytes += bytes;
+}
+
+void Trace::writeChromeTrace(std::ostream& out)
+{
+	std::vector<int> threads;
+	std::vector<Event> events = allEvents(threads);
+
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	int threadCount = threads.empty() ? 0 : *std::max_element(threads.begin(), threads.end()) + 1;
+	for (int t = 0; t < threadCount; t++)
+		out << line("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}},\n", t, t);
+	for (std::size_t i = 0; i < events.size(); i++)
+	{
+		const Event& e = events[i];
+		out << line("{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,",
+			e.name, e.category, threads[i], e.begin / 1e3, e.duration / 1e3);
+		out << line("\"args\":{\"pixels\":%lld,\"bytes\":%lld,\"rows\":%lld}}", e.pixels, e.bytes, e.rows);
+		out << (i + 1 < events.size() ? ",\n" : "\n");
+	}
+	out << "]}\n";
+}
+
+void Trace::writeSummary(std::ostream& out)
+{
+	std::vector<int> threads;
+	std::vector<Event> events = allEvents(threads);
+
+	struct Total
+	{
+		long long calls = 0, time = 0, longest = 0, pixels = 0, bytes = 0;
+	};
+	std::map<std::pair<std::string, std::string>, Total> byName;
+	std::map<int, Total> byThread;
+	for (std::size_t i = 0; i < events.size(); i++)
+	{
+		const Event& e = events[i];
+		Total& total = byName[{ e.category, e.name }];
+		total.calls++;
+		total.time += e.duration;
+		total.longest = std::max(total.longest, e.duration);
+		total.pixels += e.pixels;
+		total.bytes += e.bytes;
+		if (std::strcmp(e.category, "band") == 0)
+		{
+			Total& thread = byThread[threads[i]];
+			thread.calls++;
+			thread.time += e.duration;
+		}
+	}
+
+	std::vector<std::pair<std::pair<std::string, std::string>, Total>> rows(byName.begin(), byName.end());
+	std::stable_sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) { return a.second.time > b.second.time; });
+	out << line("%-8s %-20s %7s %11s %9s %9s %9s %10s\n", "kind", "name", "calls", "total ms", "mean ms", "max ms", "MP/s", "alloc MB");
+	for (const auto& row : rows)
+	{
+		const Total& t = row.second;
+		std::string rate = t.pixels > 0 && t.time > 0 ? line("%9.1f", t.pixels * 1e3 / t.time) : line("%9s", "-");
+		out << line("%-8s %-20s %7lld %11.2f %9.3f %9.3f %s %10.1f\n", row.first.first.c_str(), row.first.second.c_str(),
+			t.calls, t.time / 1e6, t.time / 1e6 / t.calls, t.longest / 1e6, rate.c_str(), t.bytes / 1048576.0);
+	}
+
+	if (byThread.empty())
+		return;
+	out << line("\n%-8s %7s %11s\n", "thread", "bands", "busy ms");
+	for (const auto& thread : byThread)
+		out << line("%-8d %7lld %11.2f\n", thread.first, thread.second.calls, thread.second.time / 1e6);
+}
+
+TraceScope::TraceScope(const char* name, const char* category, long long pixels)
+	: pixels(pixels), name(name), category(category), outer(innermost), begin(0), active(false)
+{
+	if (!name || (outer && std::strcmp(outer->name, name) == 0 && std::strcmp(outer->category, category) == 0))
+		return;
+	active = true;
+	innermost = this;
+	begin = now();
+}
+
+TraceScope::~TraceScope()
+{
+	if (!active)
+		return;
+	long long end = now();
+	innermost = outer;
+	Buffer& buffer = localBuffer();
+	std::lock_guard<std::mutex> guard(buffer.lock);
+	buffer.events.push_back({ name, category, begin, end - begin, pixels, bytes, rows });
+}
+
+#endif
@@ -0,0 +1,71 @@
+#pragma once
+#include <iosfwd>
+#include <typeinfo>
+
+// Instrumentation of filter execution, compiled in only when CGLAB_TRACE is
+// defined; otherwise the CGLAB_TRACE_* macros expand to nothing. Even when
+// compiled in, scopes record only between Trace::start() and Trace::stop().
+//
+// A scope records wall time, the thread it ran on, pixels processed and image
+// bytes allocated while it was the innermost scope of its thread. Process
+// scopes wrap Filter::process and its overrides, band scopes every row band
+// forEachBand hands to a thread, stage scopes the batch decode and encode.
+// A recorded scope costs about 0.2 us, which is lost in the noise at 1 MP
+// and about 5% of a point filter on a 64x64 image.
+
+#if defined(CGLAB_TRACE)
+
+class Trace
+{
+public:
+	static void start();
+	static void stop();
+	static bool recording();
+	// Chrome trace_event JSON (chrome://tracing, Perfetto).
+	static void writeChromeTrace(std::ostream& out);
+	// Per scope name: calls, time, throughput and allocations; per thread: bands and busy time.
+	static void writeSummary(std::ostream& out);
+	// Unqualified, demangled class name, e.g. "GaussianFilter". The string lives as long as the program.
+	static const char* nameOf(const std::type_info& type);
+	// Name of the innermost open scope of this thread, or nullptr.
+	static const char* current();
+	// Adds to the bytes of the innermost open scope of this thread.
+	static void allocated(long long bytes);
+};
+
+class TraceScope
+{
+public:
+	// Records nothing if name is nullptr or the innermost scope has the same
+	// name and category, e.g. an override delegating to the base process().
+	TraceScope(const char* name, const char* category, long long pixels = 0);
+	~TraceScope();
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+	long long pixels;
+	long long bytes = 0;
+	long long rows = 0;
+private:
+	const char* name;
+	const char* category;
+	TraceScope* outer;
+	long long begin;
+	bool active;
+
+	friend class Trace;
+};
+
+#define CGLAB_TRACE_SCOPE(name, category) TraceScope traceScope(Trace::recording() ? (name) : nullptr, category)
+// Process scope of a filter member function, named after the dynamic type.
+#define CGLAB_TRACE_PROCESS(img) TraceScope traceScope(Trace::recording() ? Trace::nameOf(typeid(*this)) : nullptr, \
+	"process", (long long)(img).width() * (img).height())
+#define CGLAB_TRACE_ALLOCATED(count) Trace::allocated(count)
+
+#else
+
+#define CGLAB_TRACE_SCOPE(name, category)
+#define CGLAB_TRACE_PROCESS(img)
+#define CGLAB_TRACE_ALLOCATED(count)
+
+#endif